@@ -4,20 +4,26 @@
 #include "VoxelDynamicsMath.h"
 #include <vector>
 
+#include <type_traits>
+
+// Ordering used by the sorted VDList operations, resolved at compile time so
+// comparisons inline. Specialize for item types without the relational operators.
 template <typename T>
-struct IVDSortable {
-    virtual ~IVDSortable() = default;
-    virtual bool operator<(const T& other) const = 0;
-    virtual bool operator==(const T& other) const = 0;
-    virtual bool operator>(const T & other) const = 0;
-};
+struct VDSortTraits
+{
+    static bool less(const T& a, const T& b)
+    {
+        return a < b;
+    }
 
-struct IVDHashable {
-    virtual ~IVDHashable() = default;
-    virtual VDuint hashValue() const = 0;
+    static bool equal(const T& a, const T& b)
+    {
+        return a == b;
+    }
 };
 
-struct VDPointer : IVDSortable<VDPointer>, IVDHashable
+// Plain pointer sized value, trivially copyable so lists of them can be moved with memcpy
+struct VDPointer
 {
     uintptr_t value;
 
@@ -31,22 +37,10 @@ struct VDPointer : IVDSortable<VDPointer>, IVDHashable
         value = _value;
     }
 
-    VDPointer(const VDPointer& other) : 
-        value(other.value) {}
-
     template<typename T>
     VDPointer(T* ptr)
         : value(reinterpret_cast<uintptr_t>(ptr)) {}
 
-    VDPointer& operator=(const VDPointer& other)
-    {
-        if (this != &other)
-        {
-            value = other.value;
-        }
-        return *this;
-    }
-
     VDPointer& operator=(const uintptr_t& _value)
     {
         value = _value;
@@ -67,538 +61,1969 @@ struct VDPointer : IVDSortable<VDPointer>, IVDHashable
     }
 
 
-    bool operator<(const VDPointer& other) const override
+    bool operator<(const VDPointer& other) const
     {
         return value < other.value;
     }
 
-    bool operator>(const VDPointer& other) const override
+    bool operator>(const VDPointer& other) const
     {
         return value > other.value;
     }
 
-    bool operator==(const VDPointer& other) const override
+    bool operator==(const VDPointer& other) const
     {
         return value == other.value;
     }
+};
 
-    VDuint hashValue() const override
-    {
-        return static_cast<VDuint>(value);
-    }
+static_assert(sizeof(VDPointer) == sizeof(uintptr_t), "VDPointer must stay pointer sized");
+static_assert(std::is_trivially_copyable<VDPointer>::value, "VDPointer must stay trivially copyable");
+
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <typeinfo>
+
+#define ALLOCATOR_MAGAZINE_SIZE 32
+#define ALLOCATOR_DEPOT_MAX_FULL_MAGAZINES 64
+
+// Snapshot of one pool, see VDAllocator::getStats. Live counts change on construct and destroy,
+// so slots cached by threads count as free; counters other than bytes/slots need VD_ALLOCATOR_STATS.
+struct VDPoolStats
+{
+    const char* typeName;
+    VDuint arraySize;
+    size_t slotSize;
+    size_t bytesReserved;
+    uint64_t slotsReserved;
+    uint64_t liveObjects;
+    uint64_t freeObjects;
+    uint64_t highWaterMark;
+    uint64_t totalAllocations;
+    uint64_t frameAllocations;
+    uint64_t frameFrees;
 };
 
-struct VDBaseObjectPool 
+// Snapshot of the frame arenas, see VDAllocator::getArenaStats
+struct VDArenaStats
 {
-    virtual ~VDBaseObjectPool() = default;
-    virtual void* allocate() = 0;
-    virtual void free(void* obj) = 0;
+    // Arenas alive on any thread and the bytes their blocks hold
+    VDuint arenaCount;
+    size_t bytesReserved;
+    // Bytes the calling thread's arena handed out since its last reset
+    size_t bytesUsed;
+    // Most bytes any arena handed out between two resets
+    size_t highWaterMark;
 };
 
-template <typename T>
-struct VDObjectPool : public VDBaseObjectPool
+// Fixed size stack of free slots, the unit exchanged between thread caches and a pool's depot
+struct VDMagazine
 {
-    std::vector<std::vector<std::vector<T>>> pools;
-    std::vector<T*> available;
-    VDuint capacity;
-    VDuint arraySize;
+    VDuint count;
+    VDMagazine* pNext;
+    void* slots[ALLOCATOR_MAGAZINE_SIZE];
 
-    void addPool()
+    VDMagazine()
     {
-        std::vector<std::vector<T>> pool;
-        pool.reserve(capacity);
-        for (VDuint i = 0; i < capacity; ++i)
-        {
-            std::vector<T> arr;
-            arr.resize(arraySize);
-            pool.push_back(arr);
-        }
-        pools.push_back(std::move(pool));
-
-        size_t lastInd = pools.size() - 1;
-        for (VDuint i = 0; i < capacity; ++i)
-        {
-            available.push_back(&pools[lastInd][i][0]);
-        }
+        count = 0;
+        pNext = nullptr;
     }
+};
 
-    VDObjectPool(VDuint _capacity, VDuint _arraySize) : 
-        capacity(_capacity), arraySize(_arraySize)
+struct VDBaseObjectPool 
+{
+    // Guards the slot free list, the slabs and the magazine depot
+    std::mutex mutex;
+    VDMagazine* pFullMagazines;
+    VDMagazine* pEmptyMagazines;
+    VDuint fullMagazineCount;
+#ifdef VD_ALLOCATOR_STATS
+    std::atomic<uint64_t> liveObjects;
+    std::atomic<uint64_t> highWaterMark;
+    std::atomic<uint64_t> totalAllocations;
+    std::atomic<uint64_t> frameAllocations;
+    std::atomic<uint64_t> frameFrees;
+#endif
+
+    VDBaseObjectPool()
     {
-        addPool();
-        available.reserve(_capacity);
+        pFullMagazines = nullptr;
+        pEmptyMagazines = nullptr;
+        fullMagazineCount = 0;
+#ifdef VD_ALLOCATOR_STATS
+        liveObjects = 0;
+        highWaterMark = 0;
+        totalAllocations = 0;
+        frameAllocations = 0;
+        frameFrees = 0;
+#endif
     }
 
-    ~VDObjectPool()
+    virtual ~VDBaseObjectPool()
     {
-
+        deleteMagazines(pFullMagazines);
+        deleteMagazines(pEmptyMagazines);
     }
 
-    void* allocate() override
+    virtual void* allocate() = 0;
+    virtual void free(void* obj) = 0;
+    virtual VDuint trim() = 0;
+    virtual VDPoolStats getStats() = 0;
+
+    void recordAllocation()
     {
-        if (available.empty()) 
+#ifdef VD_ALLOCATOR_STATS
+        uint64_t live = liveObjects.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint64_t high = highWaterMark.load(std::memory_order_relaxed);
+        while (live > high && !highWaterMark.compare_exchange_weak(high, live, std::memory_order_relaxed))
         {
-            addPool();
         }
-        T* obj = available.back();
-        available.pop_back();
-        return obj;
+        totalAllocations.fetch_add(1, std::memory_order_relaxed);
+        frameAllocations.fetch_add(1, std::memory_order_relaxed);
+#endif
     }
 
-
-    void free(void* obj) override
+    void recordFree()
     {
-        available.push_back(static_cast<T*>(obj));
+#ifdef VD_ALLOCATOR_STATS
+        liveObjects.fetch_sub(1, std::memory_order_relaxed);
+        frameFrees.fetch_add(1, std::memory_order_relaxed);
+#endif
     }
-};
-
-#include <typeindex>
-#include <typeinfo>
-#include <unordered_map>
-
-#define ALLOCATOR_INITIAL_CAPACITY 100
-#define ALLOCATOR_HASH_DEFUALT_CAPACITY 10
 
-struct VDAllocator 
-{
-    std::unordered_map<std::type_index, std::unordered_map<VDuint, VDBaseObjectPool*>> pools;
+    void markFrame()
+    {
+#ifdef VD_ALLOCATOR_STATS
+        frameAllocations.store(0, std::memory_order_relaxed);
+        frameFrees.store(0, std::memory_order_relaxed);
+#endif
+    }
 
-    template <typename T>
-    void createPool(unsigned int capacity, VDuint arraySize) 
+    void fillCounters(VDPoolStats& stats) const
     {
-        pools[typeid(T)][arraySize] = new VDObjectPool<T>(capacity, arraySize);
+#ifdef VD_ALLOCATOR_STATS
+        stats.liveObjects = liveObjects.load(std::memory_order_relaxed);
+        stats.highWaterMark = highWaterMark.load(std::memory_order_relaxed);
+        stats.totalAllocations = totalAllocations.load(std::memory_order_relaxed);
+        stats.frameAllocations = frameAllocations.load(std::memory_order_relaxed);
+        stats.frameFrees = frameFrees.load(std::memory_order_relaxed);
+#else
+        stats.liveObjects = 0;
+        stats.highWaterMark = 0;
+        stats.totalAllocations = 0;
+        stats.frameAllocations = 0;
+        stats.frameFrees = 0;
+#endif
     }
 
-    template <typename T>
-    T* allocate(VDuint arraySize) 
+    // Raw slot access, the caller must hold the mutex
+    virtual void* allocateSlot() = 0;
+    virtual void freeSlot(void* slot) = 0;
+
+    static void deleteMagazines(VDMagazine* pMagazine)
     {
-        return allocate<T>(arraySize, ALLOCATOR_INITIAL_CAPACITY);
+        while (pMagazine != nullptr)
+        {
+            VDMagazine* pNext = pMagazine->pNext;
+            delete pMagazine;
+            pMagazine = pNext;
+        }
     }
-    
-    template <typename T>
-    T* allocate(VDuint arraySize, VDuint allocatorCapacity)
+
+    // Trades an empty magazine for a full one, filling it from the slabs if the depot has none
+    VDMagazine* exchangeForFull(VDMagazine* pEmpty)
     {
-        auto typeIt = pools.find(typeid(T));
-        if (typeIt == pools.end())
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pFullMagazines != nullptr)
         {
-            createPool<T>(allocatorCapacity, arraySize);
-            typeIt = pools.find(typeid(T));
+            VDMagazine* pFull = pFullMagazines;
+            pFullMagazines = pFull->pNext;
+            fullMagazineCount--;
+            pEmpty->pNext = pEmptyMagazines;
+            pEmptyMagazines = pEmpty;
+            return pFull;
         }
+        // Filled top down so slots pop in the order the free list would have given them
+        for (VDuint i = ALLOCATOR_MAGAZINE_SIZE; i > 0; --i)
+            pEmpty->slots[i - 1] = allocateSlot();
+        pEmpty->count = ALLOCATOR_MAGAZINE_SIZE;
+        return pEmpty;
+    }
 
-        auto sizeIt = typeIt->second.find(arraySize);
-        if (sizeIt == typeIt->second.end())
+    // Trades a full magazine for an empty one
+    VDMagazine* exchangeForEmpty(VDMagazine* pFull)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (fullMagazineCount < ALLOCATOR_DEPOT_MAX_FULL_MAGAZINES)
         {
-            createPool<T>(allocatorCapacity, arraySize);
-            sizeIt = typeIt->second.find(arraySize);
+            pFull->pNext = pFullMagazines;
+            pFullMagazines = pFull;
+            fullMagazineCount++;
+            if (pEmptyMagazines != nullptr)
+            {
+                VDMagazine* pEmpty = pEmptyMagazines;
+                pEmptyMagazines = pEmpty->pNext;
+                return pEmpty;
+            }
+            return new VDMagazine();
         }
+        drainMagazine(pFull);
+        return pFull;
+    }
 
-        return static_cast<T*>(sizeIt->second->allocate());
+    // Hands a magazine and any slots it holds back to the pool
+    void returnMagazine(VDMagazine* pMagazine)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        drainMagazine(pMagazine);
+        pMagazine->pNext = pEmptyMagazines;
+        pEmptyMagazines = pMagazine;
     }
 
-    template <typename T>
-    void free(T* obj, VDuint size) 
+    // Caller must hold the mutex
+    void drainMagazine(VDMagazine* pMagazine)
+    {
+        while (pMagazine->count > 0)
+            freeSlot(pMagazine->slots[--pMagazine->count]);
+    }
+
+    // Caller must hold the mutex
+    void drainDepot()
     {
-        auto poolIt = pools.find(typeid(T));
-        if (poolIt != pools.end())
+        while (pFullMagazines != nullptr)
         {
-            auto sizeIt = poolIt->second.find(size);
-            if (sizeIt != poolIt->second.end())
-                sizeIt->second->free(obj);
+            VDMagazine* pMagazine = pFullMagazines;
+            pFullMagazines = pMagazine->pNext;
+            drainMagazine(pMagazine);
+            pMagazine->pNext = pEmptyMagazines;
+            pEmptyMagazines = pMagazine;
         }
+        fullMagazineCount = 0;
     }
 };
 
-VDAllocator gAllocator;
-
+// Pool of fixed size arrays of T. Each growth step reserves one contiguous slab of
+// capacity slots and free slots are chained through an intrusive free list, so a
+// slot costs no allocation of its own and neighbouring objects share cache lines.
 template <typename T>
-struct VDList : IVDHashable, IVDSortable<VDList<T>>
+struct VDObjectPool final : public VDBaseObjectPool
 {
+    struct VDFreeSlot
+    {
+        VDFreeSlot* pNext;
+    };
 
-    struct VDListData
+    struct VDSlab
     {
-        T item;
-        VDListData* pNext;
+        void* memory;
+        char* slots;
+    };
 
-        VDListData()
-        {
-            pNext = nullptr;
-        }
+    std::vector<VDSlab> slabs;
+    VDFreeSlot* pFreeList;
+    VDuint capacity;
+    VDuint arraySize;
+    size_t slotSize;
+    size_t slotAlignment;
 
-        VDListData(T _item)
+    void addSlab()
+    {
+        VDSlab slab;
+        slab.memory = std::malloc(slotSize * capacity + slotAlignment - 1);
+        if (slab.memory == nullptr)
+            throw std::bad_alloc();
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(slab.memory) + slotAlignment - 1) & ~(uintptr_t)(slotAlignment - 1);
+        slab.slots = reinterpret_cast<char*>(aligned);
+        slabs.push_back(slab);
+
+        // Thread back to front so slots are handed out in address order
+        for (VDuint i = capacity; i > 0; --i)
         {
-            item = _item;
-            pNext = nullptr;
+            VDFreeSlot* pSlot = reinterpret_cast<VDFreeSlot*>(slab.slots + (i - 1) * slotSize);
+            pSlot->pNext = pFreeList;
+            pFreeList = pSlot;
         }
+    }
 
-        VDListData(T _item, VDListData* _pNext)
-        {
-            item = _item;
-            pNext = _pNext;
-        }
+    VDObjectPool(VDuint _capacity, VDuint _arraySize) : 
+        capacity(_capacity), arraySize(_arraySize)
+    {
+        pFreeList = nullptr;
+        slotAlignment = alignof(T) > alignof(VDFreeSlot) ? alignof(T) : alignof(VDFreeSlot);
+        slotSize = sizeof(T) * arraySize > sizeof(VDFreeSlot) ? sizeof(T) * arraySize : sizeof(VDFreeSlot);
+        slotSize = (slotSize + slotAlignment - 1) & ~(slotAlignment - 1);
+        if (capacity == 0)
+            capacity = 1;
+        addSlab();
+    }
 
-        void setData(T _item, VDListData* _pNext)
+    ~VDObjectPool()
+    {
+        for (size_t i = 0; i < slabs.size(); i++)
+            std::free(slabs[i].memory);
+    }
+
+    void* allocateSlot() override
+    {
+        if (pFreeList == nullptr) 
         {
-            item = _item;
-            pNext = _pNext;
+            addSlab();
         }
-    };
+        VDFreeSlot* pSlot = pFreeList;
+        pFreeList = pSlot->pNext;
+        return pSlot;
+    }
 
-    VDuint count;
-    VDListData* pFirst;
-    VDuint id;
-    bool autoFree;
+    void freeSlot(void* slot) override
+    {
+        VDFreeSlot* pSlot = static_cast<VDFreeSlot*>(slot);
+        pSlot->pNext = pFreeList;
+        pFreeList = pSlot;
+    }
 
-    VDList(bool _autoFree = false)
+    T* construct(void* slot)
     {
-        count = 0;
-        pFirst = nullptr;
-        autoFree = _autoFree;
+        recordAllocation();
+        T* arr = static_cast<T*>(slot);
+        for (VDuint i = 0; i < arraySize; i++)
+            new (&arr[i]) T();
+        return arr;
     }
 
-    T* insert(T item)
+    void destroy(T* arr)
     {
-        if (pFirst == nullptr)
-        {
-            pFirst = gAllocator.allocate<VDListData>(1);
-            pFirst->setData(item, nullptr);
-        }
-        else
-        {
-            VDListData* pNext = pFirst;
-            pFirst = gAllocator.allocate<VDListData>(1);
-            pFirst->setData(item, pNext);
-        }
-        count++;
-        return &pFirst->item;
+        recordFree();
+        for (VDuint i = 0; i < arraySize; i++)
+            arr[i].~T();
     }
 
-    VDList& operator=(const VDList& other)
+    void* allocate() override
     {
-        if (&other != this)
+        void* slot;
         {
-            pFirst = other.pFirst;
-            count = other.count;
-            id = other.id;
-            autoFree = other.autoFree;
+            std::lock_guard<std::mutex> lock(mutex);
+            slot = allocateSlot();
         }
-        return *this;
+        return construct(slot);
     }
 
-    bool contains(T item)
+
+    void free(void* obj) override
     {
-        for (VDListData* pData = pFirst; pData != nullptr; pData = pData->pNext)
-        {
-            if (item == pData->item)
-                return true;
-            return false;
-        }
+        destroy(static_cast<T*>(obj));
+        std::lock_guard<std::mutex> lock(mutex);
+        freeSlot(obj);
     }
 
-    bool insertUnique(T item)
+    size_t findSlab(const void* obj) const
     {
-        if (!contains(item))
+        const char* p = static_cast<const char*>(obj);
+        size_t lo = 0;
+        size_t hi = slabs.size();
+        while (hi - lo > 1)
         {
-            VDListData* newNode = gAllocator.allocate<VDListData>();
-            newNode->setData(item, pFirst);
-            pFirst = newNode;
-            count++;
-            return true;
+            size_t mid = (lo + hi) / 2;
+            if (p < slabs[mid].slots)
+                hi = mid;
+            else
+                lo = mid;
         }
+        return lo;
     }
 
-    T* insertSorted(T item)
+    VDPoolStats getStats() override
     {
-        T* itemLoc;
-        if (pFirst == nullptr || item < pFirst->item)
-        {
-            // Allocate a new node and point it to the current first node
-            VDListData* newNode = gAllocator.allocate<VDListData>(1);
-            newNode->setData(item, pFirst);
-            // Update pFirst to point to the new node
-            pFirst = newNode;
-            itemLoc = &newNode->item;
-        }
-        else
+        VDPoolStats stats;
+        stats.typeName = typeid(T).name();
+        stats.arraySize = arraySize;
+        stats.slotSize = slotSize;
         {
-            VDListData* current = pFirst;
-            while (current->pNext != nullptr && current->pNext->item < item)
-            {
-                current = current->pNext;
-            }
-            // Insert the new node in the correct position
-            VDListData* newNode = gAllocator.allocate<VDListData>(1);
-            newNode->setData(item, current->pNext);
-            current->pNext = newNode;
-            itemLoc = &newNode->item;
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.slotsReserved = (uint64_t)slabs.size() * capacity;
         }
-        count++;
-        return itemLoc;
+        stats.bytesReserved = stats.slotsReserved * slotSize;
+        fillCounters(stats);
+#ifdef VD_ALLOCATOR_STATS
+        stats.freeObjects = stats.slotsReserved - stats.liveObjects;
+#else
+        stats.freeObjects = 0;
+#endif
+        return stats;
     }
 
-    T* insertSortedUnique(T item)
+    // Releases slabs with no live objects back to the system, always keeping one.
+    // Slots cached by threads count as live. Returns the number of slabs released.
+    VDuint trim() override
     {
-        T* itemLoc = nullptr;
-        // Check if the list is empty or if the new item should be the first element
-        if (pFirst == nullptr || item < pFirst->item)
+        std::lock_guard<std::mutex> lock(mutex);
+        drainDepot();
+        if (slabs.size() <= 1)
+            return 0;
+        std::sort(slabs.begin(), slabs.end(), [](const VDSlab& a, const VDSlab& b) { return a.slots < b.slots; });
+        std::vector<VDuint> freeCounts(slabs.size(), 0);
+        for (VDFreeSlot* pSlot = pFreeList; pSlot != nullptr; pSlot = pSlot->pNext)
+            freeCounts[findSlab(pSlot)]++;
+
+        std::vector<bool> release(slabs.size(), false);
+        VDuint kept = 0;
+        for (size_t i = 0; i < slabs.size(); i++)
         {
-            // Allocate and insert the new node at the beginning
-            VDListData* newNode = gAllocator.allocate<VDListData>(1);
-            newNode->setData(item, pFirst);
-            pFirst = newNode;
-            count++;
-            itemLoc = &newNode->item;
+            release[i] = freeCounts[i] == capacity;
+            if (!release[i])
+                kept++;
         }
-        else if (item == pFirst->item)
+        if (kept == 0)
+            release[0] = false;
+
+        VDFreeSlot* pKeptFirst = nullptr;
+        VDFreeSlot** ppKeptLast = &pKeptFirst;
+        for (VDFreeSlot* pSlot = pFreeList; pSlot != nullptr; pSlot = pSlot->pNext)
         {
-            // Do nothing if the sort value is not unique (i.e., equal to the first node's sort value)
-            return nullptr;
+            if (!release[findSlab(pSlot)])
+            {
+                *ppKeptLast = pSlot;
+                ppKeptLast = &pSlot->pNext;
+            }
         }
-        else
-        {
-            VDListData* current = pFirst;
+        *ppKeptLast = nullptr;
+        pFreeList = pKeptFirst;
 
-            // Traverse the list to find the correct position to insert
-            while (current->pNext != nullptr && current->pNext->item < item)
+        VDuint released = 0;
+        std::vector<VDSlab> remaining;
+        for (size_t i = 0; i < slabs.size(); i++)
+        {
+            if (release[i])
             {
-                current = current->pNext;
+                std::free(slabs[i].memory);
+                released++;
             }
-
-            // Check if the sort value is unique before insertion
-            if (current->pNext == nullptr || current->pNext->item > item)
+            else
             {
-                // Allocate and insert the new node at the correct position
-                VDListData* newNode = gAllocator.allocate<VDListData>(1);
-                newNode->setData(item, current->pNext);
-                current->pNext = newNode;
-                itemLoc = &newNode->item;
-                count++;
+                remaining.push_back(slabs[i]);
             }
-            // If sort values match, do not insert
         }
-        return itemLoc;
+        slabs.swap(remaining);
+        return released;
     }
+};
 
-    T pop()
+// Per thread front end for the typed pools. Each pool gets a loaded and a previous
+// magazine, allocation and free only touch these, and whole magazines are swapped
+// with the pool's depot when both run empty or full.
+struct VDThreadCache
+{
+    struct VDCacheEntry
     {
-        if (pFirst == nullptr)
-        {
-            throw std::runtime_error("Cannot pop from an empty list.");
-        }
-
-        T item = pFirst->item;
-        VDListData* temp = pFirst;
-        pFirst = pFirst->pNext;
+        VDBaseObjectPool* pPool;
+        VDMagazine* pLoaded;
+        VDMagazine* pPrevious;
+    };
 
-        // Free the memory of the old first node
-        gAllocator.free<VDListData>(temp, 1);
-        count--;
+    std::vector<VDCacheEntry> entries;
 
-        return item;
+    ~VDThreadCache()
+    {
+        for (size_t i = 0; i < entries.size(); i++)
+            release(entries[i]);
     }
 
-    void remove(T item) 
+    static VDThreadCache& local()
     {
-        if (pFirst == nullptr) return;
+        thread_local VDThreadCache cache;
+        return cache;
+    }
 
-        if (pFirst->item == item) 
+    void release(VDCacheEntry& entry)
+    {
+        if (entry.pPool != nullptr)
         {
-            VDListData* temp = pFirst;
-            pFirst = pFirst->pNext;
-            gAllocator.free<VDListData>(temp);
-            count--;
-            return;
+            entry.pPool->returnMagazine(entry.pLoaded);
+            entry.pPool->returnMagazine(entry.pPrevious);
+            entry.pPool = nullptr;
         }
+    }
 
-        VDListData* current = pFirst;
-        while (current->pNext != nullptr) 
+    VDCacheEntry& getEntry(VDuint id, VDBaseObjectPool* pPool)
+    {
+        if (id >= entries.size())
+            entries.resize(id + 1, { nullptr, nullptr, nullptr });
+        VDCacheEntry& entry = entries[id];
+        if (entry.pPool != pPool)
         {
-            if (current->pNext->item == item) 
-            {
-                VDListData* temp = current->pNext;
-                current->pNext = current->pNext->pNext;
-                gAllocator.free<VDListData>(temp);
-                count--;
-                return;
-            }
-            current = current->pNext;
+            release(entry);
+            entry.pPool = pPool;
+            entry.pLoaded = new VDMagazine();
+            entry.pPrevious = new VDMagazine();
         }
+        return entry;
     }
 
-    void removeSorted(T item) {
-        if (pFirst == nullptr) return;
+    void* pop(VDuint id, VDBaseObjectPool* pPool)
+    {
+        VDCacheEntry& entry = getEntry(id, pPool);
+        if (entry.pLoaded->count == 0)
+        {
+            if (entry.pPrevious->count == 0)
+                entry.pPrevious = pPool->exchangeForFull(entry.pPrevious);
+            VDMagazine* pTemp = entry.pLoaded;
+            entry.pLoaded = entry.pPrevious;
+            entry.pPrevious = pTemp;
+        }
+        return entry.pLoaded->slots[--entry.pLoaded->count];
+    }
 
-        if (pFirst->item == item) 
+    void push(VDuint id, VDBaseObjectPool* pPool, void* slot)
+    {
+        VDCacheEntry& entry = getEntry(id, pPool);
+        if (entry.pLoaded->count == ALLOCATOR_MAGAZINE_SIZE)
         {
-            VDListData* temp = pFirst;
-            pFirst = pFirst->pNext;
-            gAllocator.free<VDListData>(temp, 1);
-            count--;
-            return;
+            if (entry.pPrevious->count == ALLOCATOR_MAGAZINE_SIZE)
+                entry.pPrevious = pPool->exchangeForEmpty(entry.pPrevious);
+            VDMagazine* pTemp = entry.pLoaded;
+            entry.pLoaded = entry.pPrevious;
+            entry.pPrevious = pTemp;
         }
+        entry.pLoaded->slots[entry.pLoaded->count++] = slot;
+    }
+};
 
-        VDListData* current = pFirst;
-        while (current->pNext != nullptr) 
+#include <typeindex>
+#include <unordered_map>
+#include <stdexcept>
+#include <string>
+#include <cstdio>
+
+#define ALLOCATOR_INITIAL_CAPACITY 100
+#define ALLOCATOR_MAX_TYPED_POOLS 256
+
+struct VDAllocator 
+{
+    // Guards the runtime pool map and creation of typed pools
+    std::mutex mutex;
+    std::unordered_map<std::type_index, std::unordered_map<VDuint, VDBaseObjectPool*>> pools;
+    // Pools for compile time known type and array size, indexed by typedPoolId
+    std::atomic<VDBaseObjectPool*> typedPools[ALLOCATOR_MAX_TYPED_POOLS];
+    // Tells apart the allocators in the per thread pool lookups, never reused
+    VDuint instanceId;
+
+    // Key of a runtime pool in the per thread lookups
+    struct VDPoolKey
+    {
+        VDuint allocatorId;
+        VDuint arraySize;
+        std::type_index type;
+
+        bool operator==(const VDPoolKey& other) const
         {
-            if (current->pNext->item == item) 
+            return allocatorId == other.allocatorId && arraySize == other.arraySize && type == other.type;
+        }
+    };
+
+    struct VDPoolKeyHash
+    {
+        size_t operator()(const VDPoolKey& key) const
+        {
+            return key.type.hash_code() ^ (((size_t)key.allocatorId * 31 + key.arraySize) * 0x9E3779B9u);
+        }
+    };
+
+    VDAllocator()
+    {
+        static std::atomic<VDuint> nextInstanceId(0);
+        instanceId = nextInstanceId.fetch_add(1);
+        for (VDuint i = 0; i < ALLOCATOR_MAX_TYPED_POOLS; i++)
+            typedPools[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    static VDuint nextTypedPoolId()
+    {
+        static std::atomic<VDuint> next(0);
+        VDuint id = next.fetch_add(1);
+        if (id >= ALLOCATOR_MAX_TYPED_POOLS)
+            throw std::runtime_error("Too many typed pools, raise ALLOCATOR_MAX_TYPED_POOLS.");
+        return id;
+    }
+
+    template <typename T, VDuint ArraySize>
+    static VDuint typedPoolId()
+    {
+        static const VDuint id = nextTypedPoolId();
+        return id;
+    }
+
+    // Pools found through the runtime map by this thread. Pools are never replaced or freed
+    // while their allocator lives, so a lookup only takes the mutex the first time.
+    static std::unordered_map<VDPoolKey, VDBaseObjectPool*, VDPoolKeyHash>& localPools()
+    {
+        thread_local std::unordered_map<VDPoolKey, VDBaseObjectPool*, VDPoolKeyHash> pools;
+        return pools;
+    }
+
+    // The runtime pool of T and arraySize, created with allocatorCapacity when create is set,
+    // null when there is none otherwise
+    template <typename T>
+    VDBaseObjectPool* getRuntimePool(VDuint arraySize, VDuint allocatorCapacity, bool create)
+    {
+        auto& cache = localPools();
+        VDPoolKey key = { instanceId, arraySize, std::type_index(typeid(T)) };
+        auto cacheIt = cache.find(key);
+        if (cacheIt != cache.end())
+            return cacheIt->second;
+
+        VDBaseObjectPool* pPool = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (create)
             {
-                VDListData* temp = current->pNext;
-                current->pNext = current->pNext->pNext;
-                gAllocator.free<VDListData>(temp, 1);
-                count--;
-                return;
+                pPool = findOrCreatePool<T>(arraySize, allocatorCapacity);
             }
-            if (current->pNext->item > item) 
+            else
             {
-                // Since the list is sorted, we can break early
-                break;
+                auto poolIt = pools.find(typeid(T));
+                if (poolIt != pools.end())
+                {
+                    auto sizeIt = poolIt->second.find(arraySize);
+                    if (sizeIt != poolIt->second.end())
+                        pPool = sizeIt->second;
+                }
             }
-            current = current->pNext;
         }
+        if (pPool != nullptr)
+            cache.emplace(key, pPool);
+        return pPool;
     }
 
-    void free()
+    // Caller must hold the mutex
+    template <typename T>
+    VDBaseObjectPool* findOrCreatePool(VDuint arraySize, VDuint allocatorCapacity)
     {
-        for (VDListData* pData = pFirst; pData != nullptr; pData = pData->pNext)
+        auto& sizePools = pools[typeid(T)];
+        auto sizeIt = sizePools.find(arraySize);
+        if (sizeIt == sizePools.end())
+            sizeIt = sizePools.emplace(arraySize, new VDObjectPool<T>(allocatorCapacity, arraySize)).first;
+        return sizeIt->second;
+    }
+
+    // Creates the pool for T and arraySize ahead of its first allocation. An existing pool is kept,
+    // typed and runtime paths share it, so it must have been created with the same capacity.
+    template <typename T>
+    VDObjectPool<T>* createPool(unsigned int capacity, VDuint arraySize) 
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        VDObjectPool<T>* pPool = static_cast<VDObjectPool<T>*>(findOrCreatePool<T>(arraySize, capacity));
+        if (pPool->capacity != (capacity == 0 ? 1 : capacity))
+            throw std::runtime_error("Pool already exists with a different capacity.");
+        return pPool;
+    }
+
+    template <typename T>
+    T* allocate(VDuint arraySize) 
+    {
+        return allocate<T>(arraySize, ALLOCATOR_INITIAL_CAPACITY);
+    }
+    
+    template <typename T>
+    T* allocate(VDuint arraySize, VDuint allocatorCapacity)
+    {
+        return static_cast<T*>(getRuntimePool<T>(arraySize, allocatorCapacity, true)->allocate());
+    }
+
+    template <typename T, VDuint ArraySize>
+    VDObjectPool<T>* getTypedPool()
+    {
+        VDuint id = typedPoolId<T, ArraySize>();
+        VDBaseObjectPool* pPool = typedPools[id].load(std::memory_order_acquire);
+        if (pPool != nullptr)
+            return static_cast<VDObjectPool<T>*>(pPool);
+
+        // Share the pool with the runtime map so both paths can free each other's objects
+        std::lock_guard<std::mutex> lock(mutex);
+        pPool = findOrCreatePool<T>(ArraySize, ALLOCATOR_INITIAL_CAPACITY);
+        typedPools[id].store(pPool, std::memory_order_release);
+        return static_cast<VDObjectPool<T>*>(pPool);
+    }
+
+    // Statically dispatched path for the common fixed sizes, skips the type_index lookups.
+    // Served from the calling thread's cache so it is safe to use from worker threads.
+    template <typename T, VDuint ArraySize>
+    T* allocateTyped()
+    {
+        VDObjectPool<T>* pPool = getTypedPool<T, ArraySize>();
+        void* slot = VDThreadCache::local().pop(typedPoolId<T, ArraySize>(), pPool);
+        return pPool->construct(slot);
+    }
+
+    template <typename T, VDuint ArraySize>
+    void freeTyped(T* obj)
+    {
+        VDObjectPool<T>* pPool = getTypedPool<T, ArraySize>();
+        pPool->destroy(obj);
+        VDThreadCache::local().push(typedPoolId<T, ArraySize>(), pPool, obj);
+    }
+
+    template <typename T>
+    void free(T* obj, VDuint size) 
+    {
+        VDBaseObjectPool* pPool = getRuntimePool<T>(size, 0, false);
+        if (pPool != nullptr)
+            pPool->free(obj);
+    }
+
+    VDuint trim()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        VDuint released = 0;
+        for (auto& typePools : pools)
         {
-            gAllocator.free<VDListData>(pData, 1);
+            for (auto& sizePool : typePools.second)
+                released += sizePool.second->trim();
         }
-        pFirst = nullptr;
-        count = 0;
+        return released;
     }
 
-    std::vector<T> toVector()
+    // Starts a new frame for the per frame allocation and free counters
+    void markFrame()
     {
-        std::vector<T> vec;
-        vec.reserve(count);
-        for (VDListData* pData = pFirst; pData != nullptr; pData = pData->pNext)
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& typePools : pools)
         {
-            vec.push_back(pData->item);
+            for (auto& sizePool : typePools.second)
+                sizePool.second->markFrame();
         }
-        return vec;
     }
 
-    ~VDList()
+    std::vector<VDPoolStats> getStats()
     {
-       if(autoFree)
-            free();
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<VDPoolStats> stats;
+        for (auto& typePools : pools)
+        {
+            for (auto& sizePool : typePools.second)
+                stats.push_back(sizePool.second->getStats());
+        }
+        std::sort(stats.begin(), stats.end(), [](const VDPoolStats& a, const VDPoolStats& b) { return a.bytesReserved > b.bytesReserved; });
+        return stats;
     }
 
-    VDuint hashValue() const override
+    // Defined after VDFrameArena
+    VDArenaStats getArenaStats();
+
+    std::string statsToText()
     {
-        return id;
+        std::vector<VDPoolStats> stats = getStats();
+        std::string text;
+        char line[512];
+        size_t totalBytes = 0;
+        for (size_t i = 0; i < stats.size(); i++)
+        {
+            const VDPoolStats& s = stats[i];
+            snprintf(line, sizeof(line), "%s[%u] slot %zu B, reserved %zu B (%llu slots), live %llu, free %llu, high %llu, frame +%llu/-%llu, total %llu\n",
+                s.typeName, s.arraySize, s.slotSize, s.bytesReserved, (unsigned long long)s.slotsReserved,
+                (unsigned long long)s.liveObjects, (unsigned long long)s.freeObjects, (unsigned long long)s.highWaterMark,
+                (unsigned long long)s.frameAllocations, (unsigned long long)s.frameFrees, (unsigned long long)s.totalAllocations);
+            text += line;
+            totalBytes += s.bytesReserved;
+        }
+        snprintf(line, sizeof(line), "%zu pools, %zu B reserved\n", stats.size(), totalBytes);
+        text += line;
+        VDArenaStats arenas = getArenaStats();
+        snprintf(line, sizeof(line), "%u frame arenas, %zu B reserved, %zu B used on this thread, high %zu B\n",
+            arenas.arenaCount, arenas.bytesReserved, arenas.bytesUsed, arenas.highWaterMark);
+        text += line;
+        return text;
     }
 
-    bool operator<(const VDList<T>& other) const override
+    std::string statsToJSON()
     {
-        return id < other.id;
+        std::vector<VDPoolStats> stats = getStats();
+        std::string json = "{\"pools\":[";
+        char entry[512];
+        for (size_t i = 0; i < stats.size(); i++)
+        {
+            const VDPoolStats& s = stats[i];
+            snprintf(entry, sizeof(entry), "%s{\"type\":\"%s\",\"arraySize\":%u,\"slotSize\":%zu,\"bytesReserved\":%zu,\"slotsReserved\":%llu,"
+                "\"live\":%llu,\"free\":%llu,\"highWaterMark\":%llu,\"frameAllocations\":%llu,\"frameFrees\":%llu,\"totalAllocations\":%llu}",
+                i == 0 ? "" : ",", s.typeName, s.arraySize, s.slotSize, s.bytesReserved, (unsigned long long)s.slotsReserved,
+                (unsigned long long)s.liveObjects, (unsigned long long)s.freeObjects, (unsigned long long)s.highWaterMark,
+                (unsigned long long)s.frameAllocations, (unsigned long long)s.frameFrees, (unsigned long long)s.totalAllocations);
+            json += entry;
+        }
+        VDArenaStats arenas = getArenaStats();
+        snprintf(entry, sizeof(entry), "],\"frameArenas\":{\"count\":%u,\"bytesReserved\":%zu,\"bytesUsed\":%zu,\"highWaterMark\":%zu}}",
+            arenas.arenaCount, arenas.bytesReserved, arenas.bytesUsed, arenas.highWaterMark);
+        json += entry;
+        return json;
     }
+};
+
+VDAllocator gAllocator;
+
+#define FRAME_ARENA_DEFAULT_BLOCK_SIZE (256 * 1024)
 
-    bool operator==(const VDList<T>& other) const override
+// Bump allocator for transient per-step data. Nothing allocated from it is freed
+// individually, the whole arena is rewound by reset() once per simulation step.
+// Every thread has its own arena, see local().
+struct VDFrameArena
+{
+    struct VDArenaBlock
     {
-        return id == other.id;
+        char* data;
+        size_t size;
+    };
+
+    std::vector<VDArenaBlock> blocks;
+    size_t blockSize;
+    size_t currentBlock;
+    size_t offset;
+
+    VDFrameArena(size_t _blockSize = FRAME_ARENA_DEFAULT_BLOCK_SIZE)
+    {
+        blockSize = _blockSize;
+        currentBlock = 0;
+        offset = 0;
+        arenaCount()++;
     }
 
-    bool operator>(const VDList<T>& other) const override
+    VDFrameArena(const VDFrameArena&) = delete;
+    VDFrameArena& operator=(const VDFrameArena&) = delete;
+
+    ~VDFrameArena()
     {
-        return id > other.id;
+        totalReserved() -= bytesReserved();
+        arenaCount()--;
+        for (size_t i = 0; i < blocks.size(); i++)
+            delete[] blocks[i].data;
+    }
+
+    // Totals over all arenas for VDAllocator::getArenaStats, only touched when blocks change
+    static std::atomic<VDuint>& arenaCount()
+    {
+        static std::atomic<VDuint> count(0);
+        return count;
     }
-};
 
+    static std::atomic<size_t>& totalReserved()
+    {
+        static std::atomic<size_t> total(0);
+        return total;
+    }
 
-template <typename T>
-struct VDHashList
-{
-    VDuint arraySize;
-    VDList<T>* listArray;
+    static std::atomic<size_t>& highWaterMark()
+    {
+        static std::atomic<size_t> high(0);
+        return high;
+    }
 
-    VDHashList()
+    void addBlock(size_t minSize)
     {
-        arraySize = 0;
-        listArray = nullptr;
+        size_t size = minSize > blockSize ? minSize : blockSize;
+        blocks.push_back({ new char[size], size });
+        totalReserved() += size;
     }
 
-    VDHashList(VDuint _arraySize, VDuint allocatorCapacity) : arraySize(_arraySize)
+    void* allocate(size_t size, size_t alignment)
     {
-        listArray = gAllocator.allocate<VDList<T>>(arraySize, allocatorCapacity);
+        while (currentBlock < blocks.size())
+        {
+            uintptr_t base = reinterpret_cast<uintptr_t>(blocks[currentBlock].data);
+            uintptr_t aligned = (base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+            size_t alignedOffset = aligned - base;
+            if (alignedOffset + size <= blocks[currentBlock].size)
+            {
+                offset = alignedOffset + size;
+                return reinterpret_cast<void*>(aligned);
+            }
+            currentBlock++;
+            offset = 0;
+        }
+        addBlock(size + alignment);
+        currentBlock = blocks.size() - 1;
+        offset = 0;
+        return allocate(size, alignment);
     }
 
-    VDHashList(VDuint _arraySize) : VDHashList(_arraySize, ALLOCATOR_HASH_DEFUALT_CAPACITY)
+    template <typename T>
+    T* allocate(VDuint arraySize)
     {
+        T* arr = static_cast<T*>(allocate(sizeof(T) * arraySize, alignof(T)));
+        for (VDuint i = 0; i < arraySize; i++)
+            new (&arr[i]) T();
+        return arr;
     }
 
-    VDHashList& operator=(const VDHashList& other)
+    size_t bytesReserved() const
     {
-        if (this != &other)
+        size_t total = 0;
+        for (size_t i = 0; i < blocks.size(); i++)
+            total += blocks[i].size;
+        return total;
+    }
+
+    // Bytes handed out since the last reset, with alignment and the unused ends of full blocks
+    size_t bytesUsed() const
+    {
+        size_t used = offset;
+        for (size_t i = 0; i < currentBlock && i < blocks.size(); i++)
+            used += blocks[i].size;
+        return used;
+    }
+
+    void reset()
+    {
+        size_t used = bytesUsed();
+        size_t high = highWaterMark().load(std::memory_order_relaxed);
+        while (used > high && !highWaterMark().compare_exchange_weak(high, used, std::memory_order_relaxed))
         {
-            arraySize = other.arraySize;
-            listArray = other.listArray;
         }
-        return *this;
+        // If last step spilled into more than one block, coalesce them so the
+        // next step is served from a single contiguous block
+        if (blocks.size() > 1)
+        {
+            size_t total = bytesReserved();
+            for (size_t i = 0; i < blocks.size(); i++)
+                delete[] blocks[i].data;
+            blocks.clear();
+            totalReserved() -= total;
+            addBlock(total);
+        }
+        currentBlock = 0;
+        offset = 0;
     }
 
-    void insert(T item)
+    // Arena of the calling thread. Lists bound to it must only grow on that thread, and only
+    // that thread may reset it, once none of those lists is in use any more. VDSimulation::simulate
+    // resets the arena of the thread stepping it, worker pools and streamers reset their workers'
+    // arenas after every job. Other threads running queries reset their own arena themselves.
+    static VDFrameArena& local();
+};
+
+VDFrameArena& VDFrameArena::local()
+{
+    thread_local VDFrameArena arena;
+    return arena;
+}
+
+VDArenaStats VDAllocator::getArenaStats()
+{
+    VDArenaStats stats;
+    stats.bytesUsed = VDFrameArena::local().bytesUsed();
+    stats.arenaCount = VDFrameArena::arenaCount().load();
+    stats.bytesReserved = VDFrameArena::totalReserved().load();
+    size_t high = VDFrameArena::highWaterMark().load();
+    stats.highWaterMark = high > stats.bytesUsed ? high : stats.bytesUsed;
+    return stats;
+}
+
+template <typename T>
+struct VDList
+{
+
+    struct VDListData
+    {
+        T item;
+        VDListData* pNext;
+
+        VDListData()
+        {
+            pNext = nullptr;
+        }
+
+        VDListData(T _item)
+        {
+            item = _item;
+            pNext = nullptr;
+        }
+
+        VDListData(T _item, VDListData* _pNext)
+        {
+            item = _item;
+            pNext = _pNext;
+        }
+
+        void setData(T _item, VDListData* _pNext)
+        {
+            item = _item;
+            pNext = _pNext;
+        }
+    };
+
+    VDuint count;
+    VDListData* pFirst;
+    VDuint id;
+    bool autoFree;
+    // When set nodes come from the frame arena and are released by its reset
+    VDFrameArena* pArena;
+
+    VDList(bool _autoFree = false)
     {
-        VDuint index = static_cast<IVDHashable*>(&item)->hashValue()%arraySize;
-        listArray[index].insert(item);
+        count = 0;
+        pFirst = nullptr;
+        autoFree = _autoFree;
+        pArena = nullptr;
     }
 
-    void insertSorted(T item)
+    VDList(VDFrameArena* _pArena)
     {
-        VDuint index = static_cast<IVDHashable*>(&item)->hashValue() % arraySize;
-        listArray[index].insertSorted(item);
+        count = 0;
+        pFirst = nullptr;
+        autoFree = false;
+        pArena = _pArena;
     }
 
-    void insertSortedUnique(T item)
+    VDListData* allocateNode()
     {
-        VDuint index = static_cast<IVDHashable*>(&item)->hashValue() % arraySize;
-        listArray[index].insertSortedUnique(item);
+        if (pArena != nullptr)
+            return pArena->allocate<VDListData>(1);
+        return gAllocator.allocateTyped<VDListData, 1>();
     }
 
-    void remove(T item)
+    void freeNode(VDListData* pData)
     {
-        VDuint index = static_cast<IVDHashable*>(&item)->hashValue() % arraySize;
-        listArray[index].remove(item);
+        if (pArena == nullptr)
+            gAllocator.freeTyped<VDListData, 1>(pData);
     }
 
-    void removeSorted(T item)
+    T* insert(T item)
     {
-        VDuint index = static_cast<IVDHashable*>(&item)->hashValue() % arraySize;
-        listArray[index].removeSorted(item);
+        if (pFirst == nullptr)
+        {
+            pFirst = allocateNode();
+            pFirst->setData(item, nullptr);
+        }
+        else
+        {
+            VDListData* pNext = pFirst;
+            pFirst = allocateNode();
+            pFirst->setData(item, pNext);
+        }
+        count++;
+        return &pFirst->item;
     }
 
-    T* getItemByHashValue(VDuint hashValue)
+    VDList& operator=(const VDList& other)
     {
-        hashValue = hashValue % arraySize;
-        for (auto it = listArray[hashValue].pFirst; it != nullptr; it = it->pNext)
+        if (&other != this)
         {
-            if (static_cast<IVDHashable*>(&it->item)->hashValue() == hashValue)
-                return &it->item;
+            pFirst = other.pFirst;
+            count = other.count;
+            id = other.id;
+            autoFree = other.autoFree;
+            pArena = other.pArena;
         }
-        return nullptr;
+        return *this;
     }
 
-    ~VDHashList()
+    bool contains(T item)
     {
-        for (VDuint i = 0; i < arraySize; i++)
+        for (VDListData* pData = pFirst; pData != nullptr; pData = pData->pNext)
         {
-            listArray[i].free();
+            if (item == pData->item)
+                return true;
+            return false;
         }
-        gAllocator.free<VDList<T>>(listArray, arraySize);
     }
 
-    VDList<T> toList()
+    bool insertUnique(T item)
     {
-        VDList<T> list;
-        for (VDuint i = 0; i < arraySize; i++)
+        if (!contains(item))
         {
-            for (auto it = listArray[i].pFirst; it != nullptr; it = it->pNext)
-            {
-                list.insert(it->item);
-            }
+            VDListData* newNode = allocateNode();
+            newNode->setData(item, pFirst);
+            pFirst = newNode;
+            count++;
+            return true;
         }
-        return list;
     }
 
-};  
+    T* insertSorted(T item)
+    {
+        T* itemLoc;
+        if (pFirst == nullptr || VDSortTraits<T>::less(item, pFirst->item))
+        {
+            // Allocate a new node and point it to the current first node
+            VDListData* newNode = allocateNode();
+            newNode->setData(item, pFirst);
+            // Update pFirst to point to the new node
+            pFirst = newNode;
+            itemLoc = &newNode->item;
+        }
+        else
+        {
+            VDListData* current = pFirst;
+            while (current->pNext != nullptr && VDSortTraits<T>::less(current->pNext->item, item))
+            {
+                current = current->pNext;
+            }
+            // Insert the new node in the correct position
+            VDListData* newNode = allocateNode();
+            newNode->setData(item, current->pNext);
+            current->pNext = newNode;
+            itemLoc = &newNode->item;
+        }
+        count++;
+        return itemLoc;
+    }
+
+    T* insertSortedUnique(T item)
+    {
+        T* itemLoc = nullptr;
+        // Check if the list is empty or if the new item should be the first element
+        if (pFirst == nullptr || VDSortTraits<T>::less(item, pFirst->item))
+        {
+            // Allocate and insert the new node at the beginning
+            VDListData* newNode = allocateNode();
+            newNode->setData(item, pFirst);
+            pFirst = newNode;
+            count++;
+            itemLoc = &newNode->item;
+        }
+        else if (VDSortTraits<T>::equal(item, pFirst->item))
+        {
+            // Do nothing if the sort value is not unique (i.e., equal to the first node's sort value)
+            return nullptr;
+        }
+        else
+        {
+            VDListData* current = pFirst;
+
+            // Traverse the list to find the correct position to insert
+            while (current->pNext != nullptr && VDSortTraits<T>::less(current->pNext->item, item))
+            {
+                current = current->pNext;
+            }
+
+            // Check if the sort value is unique before insertion
+            if (current->pNext == nullptr || VDSortTraits<T>::less(item, current->pNext->item))
+            {
+                // Allocate and insert the new node at the correct position
+                VDListData* newNode = allocateNode();
+                newNode->setData(item, current->pNext);
+                current->pNext = newNode;
+                itemLoc = &newNode->item;
+                count++;
+            }
+            // If sort values match, do not insert
+        }
+        return itemLoc;
+    }
+
+    T pop()
+    {
+        if (pFirst == nullptr)
+        {
+            throw std::runtime_error("Cannot pop from an empty list.");
+        }
+
+        T item = pFirst->item;
+        VDListData* temp = pFirst;
+        pFirst = pFirst->pNext;
+
+        // Free the memory of the old first node
+        freeNode(temp);
+        count--;
+
+        return item;
+    }
+
+    void remove(T item) 
+    {
+        if (pFirst == nullptr) return;
+
+        if (pFirst->item == item) 
+        {
+            VDListData* temp = pFirst;
+            pFirst = pFirst->pNext;
+            freeNode(temp);
+            count--;
+            return;
+        }
+
+        VDListData* current = pFirst;
+        while (current->pNext != nullptr) 
+        {
+            if (current->pNext->item == item) 
+            {
+                VDListData* temp = current->pNext;
+                current->pNext = current->pNext->pNext;
+                freeNode(temp);
+                count--;
+                return;
+            }
+            current = current->pNext;
+        }
+    }
+
+    void removeSorted(T item) {
+        if (pFirst == nullptr) return;
+
+        if (VDSortTraits<T>::equal(pFirst->item, item)) 
+        {
+            VDListData* temp = pFirst;
+            pFirst = pFirst->pNext;
+            freeNode(temp);
+            count--;
+            return;
+        }
+
+        VDListData* current = pFirst;
+        while (current->pNext != nullptr) 
+        {
+            if (VDSortTraits<T>::equal(current->pNext->item, item)) 
+            {
+                VDListData* temp = current->pNext;
+                current->pNext = current->pNext->pNext;
+                freeNode(temp);
+                count--;
+                return;
+            }
+            if (VDSortTraits<T>::less(item, current->pNext->item)) 
+            {
+                // Since the list is sorted, we can break early
+                break;
+            }
+            current = current->pNext;
+        }
+    }
+
+    void free()
+    {
+        if (pArena == nullptr)
+        {
+            VDListData* pData = pFirst;
+            while (pData != nullptr)
+            {
+                // The node's memory is reused by the pool once freed
+                VDListData* pNext = pData->pNext;
+                freeNode(pData);
+                pData = pNext;
+            }
+        }
+        pFirst = nullptr;
+        count = 0;
+    }
+
+    std::vector<T> toVector()
+    {
+        std::vector<T> vec;
+        vec.reserve(count);
+        for (VDListData* pData = pFirst; pData != nullptr; pData = pData->pNext)
+        {
+            vec.push_back(pData->item);
+        }
+        return vec;
+    }
+
+    ~VDList()
+    {
+       if(autoFree)
+            free();
+    }
+
+    bool operator<(const VDList<T>& other) const
+    {
+        return id < other.id;
+    }
+
+    bool operator==(const VDList<T>& other) const
+    {
+        return id == other.id;
+    }
+
+    bool operator>(const VDList<T>& other) const
+    {
+        return id > other.id;
+    }
+};
+
+
+// Vector with N items stored inline, only spills to the heap past that
+template <typename T, VDuint N>
+struct VDSmallVector
+{
+    T inlineItems[N];
+    T* items;
+    VDuint count;
+    VDuint capacity;
+
+    VDSmallVector()
+    {
+        items = inlineItems;
+        count = 0;
+        capacity = N;
+    }
+
+    VDSmallVector(const VDSmallVector& other) : VDSmallVector()
+    {
+        *this = other;
+    }
+
+    VDSmallVector& operator=(const VDSmallVector& other)
+    {
+        if (this != &other)
+        {
+            count = 0;
+            reserve(other.count);
+            for (VDuint i = 0; i < other.count; i++)
+                items[i] = other.items[i];
+            count = other.count;
+        }
+        return *this;
+    }
+
+    ~VDSmallVector()
+    {
+        if (items != inlineItems)
+            delete[] items;
+    }
+
+    void reserve(VDuint _capacity)
+    {
+        if (_capacity <= capacity)
+            return;
+        T* newItems = new T[_capacity];
+        for (VDuint i = 0; i < count; i++)
+            newItems[i] = items[i];
+        if (items != inlineItems)
+            delete[] items;
+        items = newItems;
+        capacity = _capacity;
+    }
+
+    T* insert(T item)
+    {
+        if (count == capacity)
+            reserve(capacity * 2);
+        items[count] = item;
+        return &items[count++];
+    }
+
+    T& operator[](VDuint index)
+    {
+        return items[index];
+    }
+
+    const T& operator[](VDuint index) const
+    {
+        return items[index];
+    }
+
+    T* begin()
+    {
+        return items;
+    }
+
+    T* end()
+    {
+        return items + count;
+    }
+
+    void clear()
+    {
+        count = 0;
+    }
+
+    // Empties the vector and gives back any heap storage
+    void free()
+    {
+        if (items != inlineItems)
+            delete[] items;
+        items = inlineItems;
+        capacity = N;
+        count = 0;
+    }
+};
+
+// Keeps only the running sum of what is inserted, for contributions that are
+// only ever consumed as a total such as forces acting on a body
+template <typename T>
+struct VDAccumulator
+{
+    T sum;
+    VDuint count;
+
+    VDAccumulator()
+    {
+        sum = T();
+        count = 0;
+    }
+
+    void insert(T item)
+    {
+        sum += item;
+        count++;
+    }
+
+    void free()
+    {
+        sum = T();
+        count = 0;
+    }
+};
+
+#include <functional>
+
+// Hashing and equality used by VDHashMap, resolved at compile time.
+// Specialize for key types std::hash does not cover.
+template <typename K>
+struct VDHashTraits
+{
+    static uint64_t hash(const K& key)
+    {
+        return (uint64_t)std::hash<K>()(key);
+    }
+
+    static bool equal(const K& a, const K& b)
+    {
+        return a == b;
+    }
+};
+
+template <>
+struct VDHashTraits<VDPointer>
+{
+    static uint64_t hash(const VDPointer& key)
+    {
+        return (uint64_t)key.value;
+    }
+
+    static bool equal(const VDPointer& a, const VDPointer& b)
+    {
+        return a.value == b.value;
+    }
+};
+
+template <typename T>
+struct VDHashTraits<VDList<T>>
+{
+    static uint64_t hash(const VDList<T>& key)
+    {
+        return (uint64_t)key.id;
+    }
+
+    static bool equal(const VDList<T>& a, const VDList<T>& b)
+    {
+        return a.id == b.id;
+    }
+};
+
+template <>
+struct VDHashTraits<VDVector3i>
+{
+    static uint64_t hash(const VDVector3i& key)
+    {
+        uint64_t h = (uint32_t)key.x;
+        h = h * 0x100000001B3ull ^ (uint32_t)key.y;
+        h = h * 0x100000001B3ull ^ (uint32_t)key.z;
+        return h;
+    }
+
+    static bool equal(const VDVector3i& a, const VDVector3i& b)
+    {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+};
+
+#define HASH_MAP_MIN_CAPACITY 8
+#define HASH_MAP_MAX_LOAD_PERCENT 80
+
+// Open addressing hash map with Robin Hood probing over a power of two table.
+// Each slot keeps a one byte probe distance (0 means empty) in a separate array so
+// probing scans dense metadata, and removal shifts the following run back instead
+// of leaving tombstones. Pointers to values are invalidated by insertions that grow.
+template <typename K, typename V, typename Traits = VDHashTraits<K>>
+struct VDHashMap
+{
+    struct VDHashEntry
+    {
+        K key;
+        V value;
+    };
+
+    uint8_t* distances;
+    VDHashEntry* entries;
+    VDuint capacity;
+    VDuint count;
+    VDuint shift;
+
+    VDHashMap()
+    {
+        distances = nullptr;
+        entries = nullptr;
+        capacity = 0;
+        count = 0;
+        shift = 64;
+    }
+
+    VDHashMap(VDuint initialCapacity) : VDHashMap()
+    {
+        reserve(initialCapacity);
+    }
+
+    VDHashMap(const VDHashMap& other) : VDHashMap()
+    {
+        *this = other;
+    }
+
+    VDHashMap& operator=(const VDHashMap& other)
+    {
+        if (this != &other)
+        {
+            release();
+            if (other.capacity > 0)
+            {
+                allocateTable(other.capacity);
+                for (VDuint i = 0; i < capacity; i++)
+                {
+                    distances[i] = other.distances[i];
+                    if (distances[i] != 0)
+                        entries[i] = other.entries[i];
+                }
+                count = other.count;
+            }
+        }
+        return *this;
+    }
+
+    ~VDHashMap()
+    {
+        release();
+    }
+
+    void release()
+    {
+        delete[] distances;
+        delete[] entries;
+        distances = nullptr;
+        entries = nullptr;
+        capacity = 0;
+        count = 0;
+        shift = 64;
+    }
+
+    void allocateTable(VDuint _capacity)
+    {
+        capacity = _capacity;
+        shift = 64;
+        for (VDuint c = capacity; c > 1; c >>= 1)
+            shift--;
+        distances = new uint8_t[capacity];
+        memset(distances, 0, capacity);
+        entries = new VDHashEntry[capacity];
+        count = 0;
+    }
+
+    VDuint homeSlot(const K& key) const
+    {
+        // Fibonacci hashing spreads weak hashes (pointers, small ints) over the high bits
+        return (VDuint)((Traits::hash(key) * 11400714819323198485ull) >> shift);
+    }
+
+    void rehash(VDuint newCapacity)
+    {
+        uint8_t* oldDistances = distances;
+        VDHashEntry* oldEntries = entries;
+        VDuint oldCapacity = capacity;
+        allocateTable(newCapacity);
+        for (VDuint i = 0; i < oldCapacity; i++)
+        {
+            if (oldDistances[i] != 0)
+                insertNew(oldEntries[i].key, oldEntries[i].value);
+        }
+        delete[] oldDistances;
+        delete[] oldEntries;
+    }
+
+    void reserve(VDuint itemCount)
+    {
+        VDuint needed = HASH_MAP_MIN_CAPACITY;
+        while ((uint64_t)needed * HASH_MAP_MAX_LOAD_PERCENT < (uint64_t)itemCount * 100)
+            needed <<= 1;
+        if (needed > capacity)
+            rehash(needed);
+    }
+
+    // Places a key known not to be present
+    void insertNew(K key, V value)
+    {
+        VDuint mask = capacity - 1;
+        VDuint index = homeSlot(key);
+        VDuint distance = 1;
+        while (distances[index] != 0)
+        {
+            if (distances[index] < distance)
+            {
+                // Take from the rich, the displaced entry keeps probing
+                uint8_t tempDistance = distances[index];
+                distances[index] = (uint8_t)distance;
+                distance = tempDistance;
+                std::swap(key, entries[index].key);
+                std::swap(value, entries[index].value);
+            }
+            index = (index + 1) & mask;
+            distance++;
+            if (distance == 255)
+            {
+                // Probe run too long for the metadata, grow and place the carried entry again
+                rehash(capacity * 2);
+                insertNew(key, value);
+                return;
+            }
+        }
+        distances[index] = (uint8_t)distance;
+        entries[index].key = key;
+        entries[index].value = value;
+        count++;
+    }
+
+    VDuint findSlot(const K& key) const
+    {
+        if (count == 0)
+            return capacity;
+        VDuint mask = capacity - 1;
+        VDuint index = homeSlot(key);
+        for (VDuint distance = 1; distances[index] >= distance; distance++)
+        {
+            if (distances[index] == distance && Traits::equal(entries[index].key, key))
+                return index;
+            index = (index + 1) & mask;
+        }
+        return capacity;
+    }
+
+    V* find(const K& key)
+    {
+        VDuint slot = findSlot(key);
+        return slot < capacity ? &entries[slot].value : nullptr;
+    }
+
+    const V* find(const K& key) const
+    {
+        VDuint slot = findSlot(key);
+        return slot < capacity ? &entries[slot].value : nullptr;
+    }
+
+    bool contains(const K& key) const
+    {
+        return findSlot(key) < capacity;
+    }
+
+    // Inserts or overwrites, returns a pointer to the stored value
+    V* insert(const K& key, const V& value)
+    {
+        VDuint slot = findSlot(key);
+        if (slot < capacity)
+        {
+            entries[slot].value = value;
+            return &entries[slot].value;
+        }
+        if ((uint64_t)(count + 1) * 100 > (uint64_t)capacity * HASH_MAP_MAX_LOAD_PERCENT)
+            rehash(capacity == 0 ? HASH_MAP_MIN_CAPACITY : capacity * 2);
+        insertNew(key, value);
+        return find(key);
+    }
+
+    bool remove(const K& key)
+    {
+        VDuint slot = findSlot(key);
+        if (slot >= capacity)
+            return false;
+        VDuint mask = capacity - 1;
+        VDuint next = (slot + 1) & mask;
+        // Backward shift the rest of the run so no tombstone is needed
+        while (distances[next] > 1)
+        {
+            distances[slot] = distances[next] - 1;
+            entries[slot] = entries[next];
+            slot = next;
+            next = (next + 1) & mask;
+        }
+        distances[slot] = 0;
+        entries[slot] = VDHashEntry();
+        count--;
+        return true;
+    }
+
+    void clear()
+    {
+        if (capacity > 0)
+        {
+            memset(distances, 0, capacity);
+            for (VDuint i = 0; i < capacity; i++)
+                entries[i] = VDHashEntry();
+        }
+        count = 0;
+    }
+
+    bool occupied(VDuint slot) const
+    {
+        return distances[slot] != 0;
+    }
+
+    template <typename F>
+    void forEach(F function)
+    {
+        for (VDuint i = 0; i < capacity; i++)
+        {
+            if (distances[i] != 0)
+                function(entries[i].key, entries[i].value);
+        }
+    }
+};
+
+#define VD_INVALID_HANDLE_INDEX 0xFFFFFFFFu
+
+// Index plus generation referring to an item of relocatable storage. A handle stays
+// valid only while its slot holds the same generation, so stale handles fail lookup.
+struct VDHandle
+{
+    VDuint index;
+    VDuint generation;
+
+    VDHandle()
+    {
+        index = VD_INVALID_HANDLE_INDEX;
+        generation = 0;
+    }
+
+    VDHandle(VDuint _index, VDuint _generation)
+    {
+        index = _index;
+        generation = _generation;
+    }
+
+    bool isNull() const
+    {
+        return index == VD_INVALID_HANDLE_INDEX;
+    }
+
+    // Only one generation of a slot is live at a time, so ordering by index is enough
+    bool operator<(const VDHandle& other) const
+    {
+        return index < other.index;
+    }
+
+    bool operator>(const VDHandle& other) const
+    {
+        return index > other.index;
+    }
+
+    bool operator==(const VDHandle& other) const
+    {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const VDHandle& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+template <>
+struct VDHashTraits<VDHandle>
+{
+    static uint64_t hash(const VDHandle& key)
+    {
+        return ((uint64_t)key.index << 32) | key.generation;
+    }
+
+    static bool equal(const VDHandle& a, const VDHandle& b)
+    {
+        return a == b;
+    }
+};
+
+// Slot table behind handle based dense storage. Items live at dense indices
+// [0, count) in the owner's arrays; removal moves the last item into the hole,
+// which the owner mirrors in each of its arrays.
+struct VDHandleTable
+{
+    struct VDSlot
+    {
+        // Dense index of the item while live, next free slot while free
+        VDuint denseIndex;
+        VDuint generation;
+    };
+
+    std::vector<VDuint> itemSlots;
+    std::vector<VDSlot> slots;
+    VDuint freeSlot;
+
+    VDHandleTable()
+    {
+        freeSlot = VD_INVALID_HANDLE_INDEX;
+    }
+
+    VDuint count() const
+    {
+        return (VDuint)itemSlots.size();
+    }
+
+    void reserve(VDuint capacity)
+    {
+        itemSlots.reserve(capacity);
+        slots.reserve(capacity);
+    }
+
+    // Hands out a handle for a new item appended at dense index count()
+    VDHandle insert()
+    {
+        VDuint slotIndex;
+        if (freeSlot != VD_INVALID_HANDLE_INDEX)
+        {
+            slotIndex = freeSlot;
+            freeSlot = slots[slotIndex].denseIndex;
+        }
+        else
+        {
+            slotIndex = (VDuint)slots.size();
+            VDSlot slot;
+            slot.generation = 0;
+            slots.push_back(slot);
+        }
+        // Generations start at 1 so a default handle never resolves
+        slots[slotIndex].generation++;
+        slots[slotIndex].denseIndex = (VDuint)itemSlots.size();
+        itemSlots.push_back(slotIndex);
+        return VDHandle(slotIndex, slots[slotIndex].generation);
+    }
+
+    bool isValid(VDHandle handle) const
+    {
+        // Free slots sit on a generation never handed out, so matching it means live
+        return handle.index < slots.size() && slots[handle.index].generation == handle.generation;
+    }
+
+    VDuint denseIndex(VDHandle handle) const
+    {
+        return isValid(handle) ? slots[handle.index].denseIndex : VD_INVALID_HANDLE_INDEX;
+    }
+
+    VDHandle handleAt(VDuint denseIndex) const
+    {
+        VDuint slotIndex = itemSlots[denseIndex];
+        return VDHandle(slotIndex, slots[slotIndex].generation);
+    }
+
+    // Returns the dense index the caller must fill with its last item before popping it,
+    // or VD_INVALID_HANDLE_INDEX if the handle is stale
+    VDuint remove(VDHandle handle)
+    {
+        if (!isValid(handle))
+            return VD_INVALID_HANDLE_INDEX;
+        VDuint denseIndex = slots[handle.index].denseIndex;
+        VDuint last = (VDuint)itemSlots.size() - 1;
+        if (denseIndex != last)
+        {
+            itemSlots[denseIndex] = itemSlots[last];
+            slots[itemSlots[denseIndex]].denseIndex = denseIndex;
+        }
+        itemSlots.pop_back();
+        // Bumping the generation invalidates every outstanding handle to the slot
+        slots[handle.index].generation++;
+        slots[handle.index].denseIndex = freeSlot;
+        freeSlot = handle.index;
+        return denseIndex;
+    }
+
+    void clear()
+    {
+        for (VDuint i = 0; i < itemSlots.size(); i++)
+        {
+            VDuint slotIndex = itemSlots[i];
+            slots[slotIndex].generation++;
+            slots[slotIndex].denseIndex = freeSlot;
+            freeSlot = slotIndex;
+        }
+        itemSlots.clear();
+    }
+};
+
+// Items packed densely in insertion order behind a VDHandleTable. Pointers into the
+// map only stay valid until the next insert or remove; hold handles instead.
+template <typename T>
+struct VDSlotMap
+{
+    VDHandleTable table;
+    std::vector<T> items;
+
+    VDuint count() const
+    {
+        return (VDuint)items.size();
+    }
+
+    void reserve(VDuint capacity)
+    {
+        table.reserve(capacity);
+        items.reserve(capacity);
+    }
+
+    VDHandle insert(const T& item)
+    {
+        items.push_back(item);
+        return table.insert();
+    }
+
+    bool isValid(VDHandle handle) const
+    {
+        return table.isValid(handle);
+    }
+
+    T* get(VDHandle handle)
+    {
+        VDuint denseIndex = table.denseIndex(handle);
+        return denseIndex != VD_INVALID_HANDLE_INDEX ? &items[denseIndex] : nullptr;
+    }
+
+    const T* get(VDHandle handle) const
+    {
+        VDuint denseIndex = table.denseIndex(handle);
+        return denseIndex != VD_INVALID_HANDLE_INDEX ? &items[denseIndex] : nullptr;
+    }
+
+    VDHandle handleAt(VDuint denseIndex) const
+    {
+        return table.handleAt(denseIndex);
+    }
+
+    bool remove(VDHandle handle)
+    {
+        VDuint denseIndex = table.remove(handle);
+        if (denseIndex == VD_INVALID_HANDLE_INDEX)
+            return false;
+        if (denseIndex != items.size() - 1)
+            items[denseIndex] = items.back();
+        items.pop_back();
+        return true;
+    }
+
+    void clear()
+    {
+        table.clear();
+        items.clear();
+    }
+
+    T& operator[](VDuint denseIndex)
+    {
+        return items[denseIndex];
+    }
+
+    const T& operator[](VDuint denseIndex) const
+    {
+        return items[denseIndex];
+    }
+
+    T* begin()
+    {
+        return items.data();
+    }
+
+    T* end()
+    {
+        return items.data() + items.size();
+    }
+};
 
 #endif
\ No newline at end of file
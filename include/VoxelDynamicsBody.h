@@ -8,8 +8,8 @@ struct VDBody : VDCollider
 	float mass;
 	VDVector3 velocity;
 	VDVector3 momentum;
-	VDList<VDVector3> deltaMomentums;
-	VDList<VDVector3> forces;
+	VDAccumulator<VDVector3> deltaMomentums;
+	VDAccumulator<VDVector3> forces;
 	float restitution;
 	bool sleeping;
 	float friction;
@@ -25,8 +25,8 @@ struct VDBody : VDCollider
 		sleeping = false;
 		useGravity = true;
 		velocity = VDVector3();
-		forces = VDList<VDVector3>();
-		deltaMomentums = VDList<VDVector3>();
+		forces = VDAccumulator<VDVector3>();
+		deltaMomentums = VDAccumulator<VDVector3>();
 	}
 
 	VDBody(VDVector3 position, VDVector3 halfExtents, float mass) :
@@ -38,29 +38,21 @@ struct VDBody : VDCollider
 		sleeping = false;
 		useGravity = true;
 		this->velocity = VDVector3();
-		forces = VDList<VDVector3>();
-		deltaMomentums = VDList<VDVector3>();
+		forces = VDAccumulator<VDVector3>();
+		deltaMomentums = VDAccumulator<VDVector3>();
 	}
 
 	void applyDeltaMomentums()
 	{
-		for (auto dpData = deltaMomentums.pFirst; dpData != nullptr; dpData = dpData->pNext)
-		{
-			momentum += dpData->item;
-		}
+		momentum += deltaMomentums.sum;
 		deltaMomentums.free();
-		deltaMomentums = VDList<VDVector3>();
 	}
 
 
 	void applyForces(float dt)
 	{
-		for (auto fData = forces.pFirst; fData != nullptr; fData = fData->pNext)
-		{
-			momentum += fData->item * dt;
-		}
+		momentum += forces.sum * dt;
 		forces.free();
-		forces = VDList<VDVector3>();
 	}
 
 	void clearForces()
@@ -83,7 +75,7 @@ struct VDBody : VDCollider
 	}
 
 
-	virtual void simulate(float dt)
+	void simulate(float dt)
 	{
 		if (!sleeping)
 		{
@@ -128,4 +120,223 @@ struct VDAgentController : VDBody
 	}
 };
 
+#define VD_BODY_FLAG_USE_GRAVITY 0x1
+
+// Simulated AABB bodies kept as parallel arrays indexed by dense index, so each
+// integration pass streams only the fields it touches. Bodies are referred to by
+// handle; dense indices change when a body is removed.
+struct VDBodyStore
+{
+	VDHandleTable table;
+	std::vector<VDVector3> positions;
+	std::vector<VDVector3> halfExtents;
+	std::vector<VDVector3> momentums;
+	std::vector<VDVector3> velocities;
+	// Summed impulses and forces waiting for the next integration
+	std::vector<VDVector3> deltaMomentums;
+	std::vector<VDVector3> forces;
+	std::vector<float> masses;
+	std::vector<float> inverseMasses;
+	std::vector<float> restitutions;
+	std::vector<float> frictions;
+	std::vector<uint8_t> flags;
+	std::vector<uint8_t> sleeping;
+	// Chunks and voxels each body is registered in, the bounds registered are positions and halfExtents
+	std::vector<VDList<VDColliderChunk>> occupiedChunks;
+
+	VDuint count() const
+	{
+		return table.count();
+	}
+
+	void reserve(VDuint capacity)
+	{
+		table.reserve(capacity);
+		positions.reserve(capacity);
+		halfExtents.reserve(capacity);
+		momentums.reserve(capacity);
+		velocities.reserve(capacity);
+		deltaMomentums.reserve(capacity);
+		forces.reserve(capacity);
+		masses.reserve(capacity);
+		inverseMasses.reserve(capacity);
+		restitutions.reserve(capacity);
+		frictions.reserve(capacity);
+		flags.reserve(capacity);
+		sleeping.reserve(capacity);
+		occupiedChunks.reserve(capacity);
+	}
+
+	VDHandle insert(VDVector3 position, VDVector3 _halfExtents, float mass)
+	{
+		positions.push_back(position);
+		halfExtents.push_back(_halfExtents);
+		momentums.push_back(VDVector3());
+		velocities.push_back(VDVector3());
+		deltaMomentums.push_back(VDVector3());
+		forces.push_back(VDVector3());
+		masses.push_back(mass);
+		inverseMasses.push_back(1.0f / mass);
+		restitutions.push_back(0.5f);
+		frictions.push_back(0.5f);
+		flags.push_back(VD_BODY_FLAG_USE_GRAVITY);
+		sleeping.push_back(false);
+		occupiedChunks.push_back(VDList<VDColliderChunk>());
+		return table.insert();
+	}
+
+	template <typename T>
+	static void moveLast(std::vector<T>& array, VDuint denseIndex)
+	{
+		if (denseIndex != array.size() - 1)
+			array[denseIndex] = array.back();
+		array.pop_back();
+	}
+
+	bool remove(VDHandle handle)
+	{
+		VDuint denseIndex = table.remove(handle);
+		if (denseIndex == VD_INVALID_HANDLE_INDEX)
+			return false;
+		moveLast(positions, denseIndex);
+		moveLast(halfExtents, denseIndex);
+		moveLast(momentums, denseIndex);
+		moveLast(velocities, denseIndex);
+		moveLast(deltaMomentums, denseIndex);
+		moveLast(forces, denseIndex);
+		moveLast(masses, denseIndex);
+		moveLast(inverseMasses, denseIndex);
+		moveLast(restitutions, denseIndex);
+		moveLast(frictions, denseIndex);
+		moveLast(flags, denseIndex);
+		moveLast(sleeping, denseIndex);
+		moveLast(occupiedChunks, denseIndex);
+		return true;
+	}
+
+	VDAABB getAABB(VDuint i) const
+	{
+		VDAABB aabb;
+		aabb.position = positions[i];
+		aabb.halfExtents = halfExtents[i];
+		aabb.setLowAndHigh();
+		return aabb;
+	}
+
+	void setSleeping(VDuint i, bool _sleeping)
+	{
+		sleeping[i] = _sleeping;
+		if (_sleeping)
+		{
+			forces[i] = VDVector3();
+			deltaMomentums[i] = VDVector3();
+			momentums[i] = VDVector3();
+			velocities[i] = VDVector3();
+		}
+	}
+
+	// Adds gravity and the accumulated forces of all awake bodies to their momentums in one pass.
+	// Written without branches so the loop streams the arrays, sleeping bodies keep their forces.
+	void applyForces(VDVector3 gravity, float dt)
+	{
+		VDuint n = count();
+		for (VDuint i = 0; i < n; i++)
+		{
+			float awake = sleeping[i] ? 0.0f : 1.0f;
+			float gravityScale = (flags[i] & VD_BODY_FLAG_USE_GRAVITY) ? masses[i] : 0.0f;
+			momentums[i] += (forces[i] + gravity * gravityScale) * (dt * awake);
+			forces[i] = forces[i] * (1.0f - awake);
+		}
+	}
+
+	// Applies the impulses collected from contacts and moves the body, forces went in through applyForces
+	void integrate(VDuint i, float dt)
+	{
+		if (sleeping[i])
+			return;
+		momentums[i] += deltaMomentums[i];
+		deltaMomentums[i] = VDVector3();
+		velocities[i] = momentums[i] * inverseMasses[i];
+		positions[i] += velocities[i] * dt;
+	}
+};
+
+// Accessor for one body of a VDBodyStore, valid until the next body insert or remove
+struct VDBodyRef
+{
+	VDBodyStore* pStore;
+	VDuint index;
+
+	VDBodyRef()
+	{
+		pStore = nullptr;
+		index = VD_INVALID_HANDLE_INDEX;
+	}
+
+	VDBodyRef(VDBodyStore* _pStore, VDuint _index)
+	{
+		pStore = _pStore;
+		index = _index;
+	}
+
+	bool isValid() const
+	{
+		return pStore != nullptr && index != VD_INVALID_HANDLE_INDEX;
+	}
+
+	VDVector3& position() const { return pStore->positions[index]; }
+	VDVector3& halfExtents() const { return pStore->halfExtents[index]; }
+	VDVector3& momentum() const { return pStore->momentums[index]; }
+	VDVector3 velocity() const { return pStore->velocities[index]; }
+	float mass() const { return pStore->masses[index]; }
+	float& restitution() const { return pStore->restitutions[index]; }
+	float& friction() const { return pStore->frictions[index]; }
+	bool isSleeping() const { return pStore->sleeping[index] != 0; }
+
+	void setMass(float mass) const
+	{
+		pStore->masses[index] = mass;
+		pStore->inverseMasses[index] = 1.0f / mass;
+	}
+
+	void setUseGravity(bool useGravity) const
+	{
+		if (useGravity)
+			pStore->flags[index] |= VD_BODY_FLAG_USE_GRAVITY;
+		else
+			pStore->flags[index] &= ~VD_BODY_FLAG_USE_GRAVITY;
+	}
+
+	void setPosition(VDVector3 position) const
+	{
+		pStore->positions[index] = position;
+	}
+
+	void setSleeping(bool sleeping) const
+	{
+		pStore->setSleeping(index, sleeping);
+	}
+
+	void addDeltaMomentum(VDVector3 deltaMomentum) const
+	{
+		pStore->deltaMomentums[index] += deltaMomentum;
+	}
+
+	void addForce(VDVector3 force) const
+	{
+		pStore->forces[index] += force;
+	}
+
+	void clearForces() const
+	{
+		pStore->forces[index] = VDVector3();
+		pStore->deltaMomentums[index] = VDVector3();
+	}
+
+	VDAABB toAABB() const
+	{
+		return pStore->getAABB(index);
+	}
+};
+
 #endif
\ No newline at end of file
@@ -478,10 +478,19 @@ struct VDOBB : VDAABB
 	}
 };
 
+// Indices of the voxels of one chunk a collider is registered in
+struct VDColliderChunk
+{
+	VDHandle chunk;
+	VDList<VDuint> voxels;
+};
+
 struct VDCollider : VDAABB
 {
 	VDColliderType colliderType;
-	VDList<VDList<VDPointer>> occupiedChunks;
+	VDList<VDColliderChunk> occupiedChunks;
+	// Key voxels store for this collider, resolved by the owner of the collider storage
+	VDHandle handle;
 
 	VDCollider() :VDAABB()
 	{
@@ -490,7 +499,7 @@ struct VDCollider : VDAABB
 
 	VDCollider(VDAABB aabb) : VDAABB(aabb)
 	{
-		occupiedChunks = VDList<VDList<VDPointer>>();
+		occupiedChunks = VDList<VDColliderChunk>();
 		colliderType = VDColliderType::AABB;
 	}
 
@@ -501,6 +510,7 @@ struct VDCollider : VDAABB
 			VDAABB::operator=(other);
 			colliderType = other.colliderType;
 			occupiedChunks = other.occupiedChunks;
+			handle = other.handle;
 		}
 
 		return *this;
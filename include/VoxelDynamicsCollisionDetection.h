@@ -2,6 +2,7 @@
 #define VOXEL_DYNAMICS_COLLISION_DETECTION
 
 #include "VoxelDynamicsCollider.h"
+#include <cfloat>
 
 #define VD_COLLIDER_TOLERANCE 1e-5
 
@@ -13,7 +14,7 @@ struct VDPenetrationField
 	VDPenetrationField()
 	{
 		memset(maxPenetrations, 0.0f, 6 * sizeof(float));
-		memset(pVoxels, NULL, 6 * sizeof(float));
+		memset(pVoxels, 0, 6 * sizeof(VDPointer));
 	}
 
 	void insertPenetration(VDDirection dir, float magnitude, VDPointer pVoxel)
@@ -306,6 +307,49 @@ bool VDRayCastAABB(VDVector3 from, VDVector3 dir, const VDAABB& aabb, VDContactI
 	return false;
 }
 
+// Slab test giving the nearest distance along dir at which the ray enters aabb and the normal of the
+// entered face, a zero normal and distance when from is inside
+bool VDRayIntersectAABB(VDVector3 from, VDVector3 dir, const VDAABB& aabb, float& distance, VDVector3& normal)
+{
+	float origin[3] = { from.x, from.y, from.z };
+	float direction[3] = { dir.x, dir.y, dir.z };
+	float low[3] = { aabb.low.x, aabb.low.y, aabb.low.z };
+	float high[3] = { aabb.high.x, aabb.high.y, aabb.high.z };
+	float tNear = 0.0f;
+	float tFar = FLT_MAX;
+	int axis = -1;
+	for (int a = 0; a < 3; a++)
+	{
+		if (direction[a] == 0.0f)
+		{
+			if (origin[a] < low[a] || origin[a] > high[a])
+				return false;
+			continue;
+		}
+		float t0 = (low[a] - origin[a]) / direction[a];
+		float t1 = (high[a] - origin[a]) / direction[a];
+		if (t0 > t1)
+			std::swap(t0, t1);
+		if (t0 > tNear)
+		{
+			tNear = t0;
+			axis = a;
+		}
+		tFar = VDMin(tFar, t1);
+		if (tNear > tFar)
+			return false;
+	}
+	distance = tNear;
+	normal = VDVector3();
+	if (axis == 0)
+		normal.x = direction[0] > 0.0f ? -1.0f : 1.0f;
+	else if (axis == 1)
+		normal.y = direction[1] > 0.0f ? -1.0f : 1.0f;
+	else if (axis == 2)
+		normal.z = direction[2] > 0.0f ? -1.0f : 1.0f;
+	return true;
+}
+
 bool VDRayCastOBB(VDVector3 from, VDVector3 dir, const VDOBB& obb, VDContactInfo& contactInfo)
 {
 	if (obb.isPointInOBB(from))
@@ -0,0 +1,419 @@
+#ifndef VOXEL_DYNAMICS_EDIT
+#define VOXEL_DYNAMICS_EDIT
+
+#include "VoxelDynamicsSpace.h"
+
+// Voxels one chunk of a bulk edit changed, in world voxel coordinates, both bounds inclusive
+struct VDDirtyChunk
+{
+	VDVector3i chunkCoord;
+	VDVector3i low;
+	VDVector3i high;
+
+	VDAABB toAABB() const
+	{
+		return VDAABB(VDVector3(low), VDVector3(high + VDVector3i(1, 1, 1)));
+	}
+};
+
+// Per chunk bounds of everything the bulk edits handed this record changed. Edits to a chunk
+// that is already listed grow its entry, so the record stays one entry per chunk until cleared.
+struct VDDirtyRegion
+{
+	std::vector<VDDirtyChunk> chunks;
+	VDHashMap<VDVector3i, VDuint> chunkEntries;
+
+	void add(VDVector3i chunkCoord, VDVector3i low, VDVector3i high)
+	{
+		VDuint* pEntry = chunkEntries.find(chunkCoord);
+		if (pEntry != nullptr)
+		{
+			VDDirtyChunk& dirty = chunks[*pEntry];
+			dirty.low = VDMin(dirty.low, low);
+			dirty.high = VDMax(dirty.high, high);
+			return;
+		}
+		VDDirtyChunk dirty;
+		dirty.chunkCoord = chunkCoord;
+		dirty.low = low;
+		dirty.high = high;
+		chunkEntries.insert(chunkCoord, (VDuint)chunks.size());
+		chunks.push_back(dirty);
+	}
+
+	bool empty() const
+	{
+		return chunks.empty();
+	}
+
+	void clear()
+	{
+		chunks.clear();
+		chunkEntries.clear();
+	}
+
+	// Box around every changed voxel
+	VDAABB bounds() const
+	{
+		if (chunks.empty())
+			return VDAABB(VDVector3::zero(), VDVector3::zero());
+		VDVector3i low = chunks[0].low;
+		VDVector3i high = chunks[0].high;
+		for (size_t i = 1; i < chunks.size(); i++)
+		{
+			low = VDMin(low, chunks[i].low);
+			high = VDMax(high, chunks[i].high);
+		}
+		return VDAABB(VDVector3(low), VDVector3(high + VDVector3i(1, 1, 1)));
+	}
+};
+
+// Bits for the voxels from x to x + count - 1 that lie in the span from spanLow to spanHigh
+uint64_t VDSpanBits(int x, VDuint count, int spanLow, int spanHigh)
+{
+	int first = VDMax(spanLow, x) - x;
+	int last = VDMin(spanHigh, x + (int)count - 1) - x;
+	if (first > last)
+		return 0;
+	return (~0ull >> (63 - last)) & (~0ull << first);
+}
+
+// Edit shapes give the world voxels they may touch from low to high, whether they hold every voxel
+// of a box, and per row the voxels they hold as bits. Convex shapes hold a box when they hold
+// its corners. A voxel belongs to a shape when its center does.
+struct VDEditBoxShape
+{
+	VDVector3i low;
+	VDVector3i high;
+
+	VDEditBoxShape(const VDAABB& box)
+	{
+		low = VDVector3i((int)ceilf(box.low.x - 0.5f), (int)ceilf(box.low.y - 0.5f), (int)ceilf(box.low.z - 0.5f));
+		high = VDVector3i((int)floorf(box.high.x - 0.5f), (int)floorf(box.high.y - 0.5f), (int)floorf(box.high.z - 0.5f));
+	}
+
+	bool covers(VDVector3i boxLow, VDVector3i boxHigh) const
+	{
+		return boxLow.x >= low.x && boxLow.y >= low.y && boxLow.z >= low.z
+			&& boxHigh.x <= high.x && boxHigh.y <= high.y && boxHigh.z <= high.z;
+	}
+
+	uint64_t rowBits(int x, int /*y*/, int /*z*/, VDuint count) const
+	{
+		return VDSpanBits(x, count, low.x, high.x);
+	}
+};
+
+struct VDEditSphereShape
+{
+	VDVector3i low;
+	VDVector3i high;
+	VDVector3 center;
+	float radius;
+
+	VDEditSphereShape(VDVector3 _center, float _radius)
+	{
+		center = _center;
+		radius = _radius;
+		low = VDVector3i((int)ceilf(center.x - radius - 0.5f), (int)ceilf(center.y - radius - 0.5f), (int)ceilf(center.z - radius - 0.5f));
+		high = VDVector3i((int)floorf(center.x + radius - 0.5f), (int)floorf(center.y + radius - 0.5f), (int)floorf(center.z + radius - 0.5f));
+	}
+
+	bool contains(int x, int y, int z) const
+	{
+		VDVector3 offset = VDVector3(x + 0.5f, y + 0.5f, z + 0.5f) - center;
+		return VDDot(offset, offset) <= radius * radius;
+	}
+
+	bool covers(VDVector3i boxLow, VDVector3i boxHigh) const
+	{
+		for (int corner = 0; corner < 8; corner++)
+		{
+			if (!contains(corner & 1 ? boxHigh.x : boxLow.x, corner & 2 ? boxHigh.y : boxLow.y, corner & 4 ? boxHigh.z : boxLow.z))
+				return false;
+		}
+		return true;
+	}
+
+	uint64_t rowBits(int x, int y, int z, VDuint count) const
+	{
+		float dy = y + 0.5f - center.y;
+		float dz = z + 0.5f - center.z;
+		float squared = radius * radius - dy * dy - dz * dz;
+		if (squared < 0.0f)
+			return 0;
+		float halfWidth = sqrtf(squared);
+		return VDSpanBits(x, count, (int)ceilf(center.x - halfWidth - 0.5f), (int)floorf(center.x + halfWidth - 0.5f));
+	}
+};
+
+// Voxels within radius of the segment from one point to another, a capsule. Radii below
+// sqrt(3) / 2 can leave diagonal lines with gaps.
+struct VDEditLineShape
+{
+	VDVector3i low;
+	VDVector3i high;
+	VDVector3 from;
+	VDVector3 to;
+	float radius;
+
+	VDEditLineShape(VDVector3 _from, VDVector3 _to, float _radius)
+	{
+		from = _from;
+		to = _to;
+		radius = _radius;
+		VDVector3 boundsLow = VDMin(from, to) - VDVector3(radius, radius, radius);
+		VDVector3 boundsHigh = VDMax(from, to) + VDVector3(radius, radius, radius);
+		low = VDVector3i((int)ceilf(boundsLow.x - 0.5f), (int)ceilf(boundsLow.y - 0.5f), (int)ceilf(boundsLow.z - 0.5f));
+		high = VDVector3i((int)floorf(boundsHigh.x - 0.5f), (int)floorf(boundsHigh.y - 0.5f), (int)floorf(boundsHigh.z - 0.5f));
+	}
+
+	bool contains(int x, int y, int z) const
+	{
+		VDVector3 point(x + 0.5f, y + 0.5f, z + 0.5f);
+		VDVector3 segment = to - from;
+		float lengthSquared = VDDot(segment, segment);
+		float t = lengthSquared > 0.0f ? VDMin(VDMax(VDDot(point - from, segment) / lengthSquared, 0.0f), 1.0f) : 0.0f;
+		VDVector3 offset = point - (from + segment * t);
+		return VDDot(offset, offset) <= radius * radius;
+	}
+
+	bool covers(VDVector3i boxLow, VDVector3i boxHigh) const
+	{
+		for (int corner = 0; corner < 8; corner++)
+		{
+			if (!contains(corner & 1 ? boxHigh.x : boxLow.x, corner & 2 ? boxHigh.y : boxLow.y, corner & 4 ? boxHigh.z : boxLow.z))
+				return false;
+		}
+		return true;
+	}
+
+	uint64_t rowBits(int x, int y, int z, VDuint count) const
+	{
+		// Along the row the distance to the segment is convex, its minimum lies under the segment
+		// point closest to the row. The voxels inside form one span found by bisection from there.
+		VDVector3 segment = to - from;
+		float crossSquared = segment.y * segment.y + segment.z * segment.z;
+		float t = 0.5f;
+		if (crossSquared > 0.0f)
+			t = VDMin(VDMax(((y + 0.5f - from.y) * segment.y + (z + 0.5f - from.z) * segment.z) / crossSquared, 0.0f), 1.0f);
+		int center = VDMin(VDMax((int)floorf(from.x + segment.x * t - 0.5f), low.x), high.x);
+		if (!contains(center, y, z))
+		{
+			if (center + 1 > high.x || !contains(center + 1, y, z))
+				return 0;
+			center++;
+		}
+		int inside = center;
+		int outside = low.x - 1;
+		while (inside - outside > 1)
+		{
+			int middle = outside + (inside - outside) / 2;
+			if (contains(middle, y, z))
+				inside = middle;
+			else
+				outside = middle;
+		}
+		int spanLow = inside;
+		inside = center;
+		outside = high.x + 1;
+		while (outside - inside > 1)
+		{
+			int middle = inside + (outside - inside) / 2;
+			if (contains(middle, y, z))
+				inside = middle;
+			else
+				outside = middle;
+		}
+		return VDSpanBits(x, count, spanLow, inside);
+	}
+};
+
+// Arbitrary set of world voxels in a box from low spanning size voxels, rows padded to whole words
+struct VDVoxelMask
+{
+	VDVector3i low;
+	VDVector3i size;
+	VDuint rowWords;
+	std::vector<uint64_t> bits;
+
+	VDVoxelMask(VDVector3i _low, VDVector3i _size)
+	{
+		low = _low;
+		size = VDMax(_size, VDVector3i(0, 0, 0));
+		rowWords = (size.x + 63) / 64;
+		bits.assign((size_t)rowWords * size.y * size.z, 0);
+	}
+
+	size_t rowWord(int y, int z) const
+	{
+		return ((size_t)(y - low.y) + (size_t)(z - low.z) * size.y) * rowWords;
+	}
+
+	bool validate(VDVector3i voxel) const
+	{
+		VDVector3i local = voxel - low;
+		return local.x >= 0 && local.y >= 0 && local.z >= 0 && local.x < size.x && local.y < size.y && local.z < size.z;
+	}
+
+	void set(VDVector3i voxel, bool value = true)
+	{
+		if (!validate(voxel))
+			return;
+		VDuint x = voxel.x - low.x;
+		uint64_t bit = 1ull << (x & 63);
+		uint64_t& word = bits[rowWord(voxel.y, voxel.z) + (x >> 6)];
+		word = value ? word | bit : word & ~bit;
+	}
+
+	bool test(VDVector3i voxel) const
+	{
+		if (!validate(voxel))
+			return false;
+		VDuint x = voxel.x - low.x;
+		return (bits[rowWord(voxel.y, voxel.z) + (x >> 6)] >> (x & 63)) & 1;
+	}
+};
+
+struct VDEditMaskShape
+{
+	VDVector3i low;
+	VDVector3i high;
+	const VDVoxelMask* pMask;
+
+	VDEditMaskShape(const VDVoxelMask& mask)
+	{
+		pMask = &mask;
+		low = mask.low;
+		high = mask.low + mask.size - VDVector3i(1, 1, 1);
+	}
+
+	bool covers(VDVector3i /*boxLow*/, VDVector3i /*boxHigh*/) const
+	{
+		return false;
+	}
+
+	uint64_t rowBits(int x, int y, int z, VDuint count) const
+	{
+		// Two neighbouring mask words hold the count bits from x on
+		VDuint offset = x - low.x;
+		size_t word = pMask->rowWord(y, z) + (offset >> 6);
+		uint64_t result = pMask->bits[word] >> (offset & 63);
+		if ((offset & 63) != 0 && (offset >> 6) + 1 < pMask->rowWords)
+			result |= pMask->bits[word + 1] << (64 - (offset & 63));
+		return result & VDSpanBits(0, count, 0, high.x - x);
+	}
+};
+
+// Applies an edit shape chunk by chunk, a word of a row at a time. Filling creates the chunks it
+// needs, clearing only visits existing ones, chunks the shape covers become uniform outright.
+// Returns the number of chunks that changed, whose changed voxels are added to pDirty.
+template <typename S>
+VDuint VDEditShape(VDSpace& space, const S& shape, bool fill, uint8_t material, VDDirtyRegion* pDirty)
+{
+	if (shape.low.x > shape.high.x || shape.low.y > shape.high.y || shape.low.z > shape.high.z)
+		return 0;
+	VDuint gridSize = space.gridSize;
+	VDuint changedChunks = 0;
+	auto editChunk = [&](VDVector3i chunkCoord, VDGrid* pChunk)
+		{
+			uint8_t target = fill ? VD_CHUNK_SOLID : VD_CHUNK_EMPTY;
+			if (pChunk != nullptr && pChunk->uniform == target && (!fill || pChunk->uniformVoxel.material == material))
+				return;
+			if (!fill && pChunk->isEmpty())
+				return;
+			VDVector3i chunkLow = space.getChunkLow(chunkCoord);
+			VDVector3i chunkHigh = chunkLow + VDVector3i(gridSize - 1, gridSize - 1, gridSize - 1);
+			if (shape.covers(chunkLow, chunkHigh))
+			{
+				space.setChunkUniform(chunkCoord, fill, material);
+				if (pDirty != nullptr)
+					pDirty->add(chunkCoord, chunkLow, chunkHigh);
+				changedChunks++;
+				return;
+			}
+			VDVector3i lowInd = VDMax(shape.low - chunkLow, VDVector3i(0, 0, 0));
+			VDVector3i highInd = VDMin(shape.high - chunkLow, VDVector3i(gridSize - 1, gridSize - 1, gridSize - 1));
+			VDVector3i dirtyLow(INT_MAX, INT_MAX, INT_MAX);
+			VDVector3i dirtyHigh(INT_MIN, INT_MIN, INT_MIN);
+			for (int z = lowInd.z; z <= highInd.z; z++)
+			{
+				for (int y = lowInd.y; y <= highInd.y; y++)
+				{
+					for (int word = lowInd.x >> 6; word <= highInd.x >> 6; word++)
+					{
+						int first = VDMax(lowInd.x, word * 64);
+						int last = VDMin(highInd.x, word * 64 + 63);
+						uint64_t bits = shape.rowBits(chunkLow.x + first, chunkLow.y + y, chunkLow.z + z, last - first + 1);
+						bits &= VDSpanBits(0, last - first + 1, 0, last - first);
+						if (bits == 0)
+							continue;
+						// Only chunks the shape actually reaches are created or given voxel storage
+						if (pChunk == nullptr)
+							pChunk = space.setChunkOccupied(chunkCoord);
+						// Uniform and compressed chunks get their dense arrays
+						pChunk->materialize();
+						uint64_t changed = pChunk->writeWord(pChunk->rowWord(y, z) + word, bits << (first & 63), fill, material);
+						if (changed == 0)
+							continue;
+						dirtyLow = VDMin(dirtyLow, VDVector3i(word * 64 + VDCountTrailingZeros(changed), y, z));
+						dirtyHigh = VDMax(dirtyHigh, VDVector3i(word * 64 + VDHighestBit(changed), y, z));
+					}
+				}
+			}
+			if (dirtyLow.x > dirtyHigh.x)
+				return;
+			pChunk->refreshBricks(dirtyLow, dirtyHigh);
+			pChunk->recordRegion(dirtyLow, dirtyHigh);
+			if (pDirty != nullptr)
+				pDirty->add(chunkCoord, chunkLow + dirtyLow, chunkLow + dirtyHigh);
+			changedChunks++;
+		};
+
+	VDAABB bounds(VDVector3(shape.low) + VDVector3::half(), VDVector3(shape.high) + VDVector3::half());
+	if (!fill)
+	{
+		VDList<VDGrid*> sampled(&VDFrameArena::local());
+		space.sampleChunks(bounds, sampled);
+		for (auto it = sampled.pFirst; it != nullptr; it = it->pNext)
+			editChunk(space.getCoordinates(it->item->chunkIndex), it->item);
+		sampled.free();
+		return changedChunks;
+	}
+	VDVector3i lowChunk = space.getChunkCoord(bounds.low);
+	VDVector3i highChunk = space.getChunkCoord(bounds.high);
+	for (int z = lowChunk.z; z <= highChunk.z; z++)
+	{
+		for (int y = lowChunk.y; y <= highChunk.y; y++)
+		{
+			for (int x = lowChunk.x; x <= highChunk.x; x++)
+				editChunk(VDVector3i(x, y, z), space.getChunk(VDVector3i(x, y, z)));
+		}
+	}
+	return changedChunks;
+}
+
+// Fills, or clears, the voxels whose centers lie in box. Filled voxels take material.
+VDuint VDEditBox(VDSpace& space, const VDAABB& box, bool fill, uint8_t material = 0, VDDirtyRegion* pDirty = nullptr)
+{
+	return VDEditShape(space, VDEditBoxShape(box), fill, material, pDirty);
+}
+
+VDuint VDEditSphere(VDSpace& space, VDVector3 center, float radius, bool fill, uint8_t material = 0, VDDirtyRegion* pDirty = nullptr)
+{
+	return VDEditShape(space, VDEditSphereShape(center, radius), fill, material, pDirty);
+}
+
+VDuint VDEditLine(VDSpace& space, VDVector3 from, VDVector3 to, float radius, bool fill, uint8_t material = 0, VDDirtyRegion* pDirty = nullptr)
+{
+	return VDEditShape(space, VDEditLineShape(from, to, radius), fill, material, pDirty);
+}
+
+VDuint VDEditMask(VDSpace& space, const VDVoxelMask& mask, bool fill, uint8_t material = 0, VDDirtyRegion* pDirty = nullptr)
+{
+	if (mask.bits.empty())
+		return 0;
+	return VDEditShape(space, VDEditMaskShape(mask), fill, material, pDirty);
+}
+
+#endif
@@ -4,6 +4,14 @@
 #include <cstring>
 #include <math.h>
 #include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+// SSE2 paths of the batched queries, with scalar fallbacks elsewhere
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VD_SSE
+#include <emmintrin.h>
+#endif
 #define PI 3.141592653589793f
 
 typedef unsigned int VDuint;
@@ -349,6 +357,39 @@ VDVector3i VDMax(VDVector3i v1, VDVector3i v2)
     return VDVector3i(VDMax(v1.x, v2.x), VDMax(v1.y, v2.y), VDMax(v1.z, v2.z));
 }
 
+// Index of the lowest set bit, bits must not be zero
+VDuint VDCountTrailingZeros(uint64_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (VDuint)index;
+#else
+    return (VDuint)__builtin_ctzll(bits);
+#endif
+}
+
+// Index of the highest set bit, bits must not be zero
+VDuint VDHighestBit(uint64_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, bits);
+    return (VDuint)index;
+#else
+    return 63 - (VDuint)__builtin_clzll(bits);
+#endif
+}
+
+VDuint VDPopCount(uint64_t bits)
+{
+#ifdef _MSC_VER
+    return (VDuint)__popcnt64(bits);
+#else
+    return (VDuint)__builtin_popcountll(bits);
+#endif
+}
+
 bool VDNan(float f)
 {
     return isnan(f);
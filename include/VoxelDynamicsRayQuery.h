@@ -0,0 +1,186 @@
+#ifndef VOXEL_DYNAMICS_RAY_QUERY
+#define VOXEL_DYNAMICS_RAY_QUERY
+
+#include "VoxelDynamicsSpace.h"
+#include "VoxelDynamicsCollisionDetection.h"
+#include "VoxelDynamicsWorkers.h"
+
+// Rays tested together by the box tests
+#define VD_RAY_PACKET 4
+// Rays handed to a worker at a time by the voxel batches
+#define VD_RAY_BATCH_GRAIN 64
+
+// Rays of a packet in structure of arrays layout, in the space of the tested box
+struct VDRayPacket
+{
+	float origin[3][VD_RAY_PACKET];
+	float direction[3][VD_RAY_PACKET];
+};
+
+// Slab test of a packet against the box from low to high. Writes the entry distance, or FLT_MAX
+// on a miss, and the entry axis, -1 when the ray starts inside, like VDRayIntersectAABB.
+void VDRayPacketSlab(const VDRayPacket& packet, const float low[3], const float high[3], float maxDistance, float tNear[VD_RAY_PACKET], int axis[VD_RAY_PACKET])
+{
+#ifdef VD_SSE
+	__m128 nearT = _mm_setzero_ps();
+	__m128 farT = _mm_set1_ps(FLT_MAX);
+	__m128i nearAxis = _mm_set1_epi32(-1);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 infinity = _mm_set1_ps(INFINITY);
+	for (int a = 0; a < 3; a++)
+	{
+		__m128 o = _mm_loadu_ps(packet.origin[a]);
+		__m128 d = _mm_loadu_ps(packet.direction[a]);
+		__m128 lo = _mm_set1_ps(low[a]);
+		__m128 hi = _mm_set1_ps(high[a]);
+		__m128 inverse = _mm_div_ps(_mm_set1_ps(1.0f), d);
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, o), inverse);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, o), inverse);
+		__m128 tMin = _mm_min_ps(t0, t1);
+		__m128 tMax = _mm_max_ps(t0, t1);
+		// Rays parallel to the slab are either always inside it or never
+		__m128 parallel = _mm_cmpeq_ps(d, zero);
+		__m128 inside = _mm_and_ps(_mm_cmpge_ps(o, lo), _mm_cmple_ps(o, hi));
+		__m128 parallelMin = _mm_or_ps(_mm_and_ps(inside, _mm_sub_ps(zero, infinity)), _mm_andnot_ps(inside, infinity));
+		__m128 parallelMax = _mm_or_ps(_mm_and_ps(inside, infinity), _mm_andnot_ps(inside, _mm_sub_ps(zero, infinity)));
+		tMin = _mm_or_ps(_mm_and_ps(parallel, parallelMin), _mm_andnot_ps(parallel, tMin));
+		tMax = _mm_or_ps(_mm_and_ps(parallel, parallelMax), _mm_andnot_ps(parallel, tMax));
+		__m128i later = _mm_castps_si128(_mm_cmpgt_ps(tMin, nearT));
+		nearAxis = _mm_or_si128(_mm_and_si128(later, _mm_set1_epi32(a)), _mm_andnot_si128(later, nearAxis));
+		nearT = _mm_max_ps(nearT, tMin);
+		farT = _mm_min_ps(farT, tMax);
+	}
+	__m128 hit = _mm_and_ps(_mm_cmple_ps(nearT, farT), _mm_cmple_ps(nearT, _mm_set1_ps(maxDistance)));
+	_mm_storeu_ps(tNear, _mm_or_ps(_mm_and_ps(hit, nearT), _mm_andnot_ps(hit, _mm_set1_ps(FLT_MAX))));
+	_mm_storeu_si128((__m128i*)axis, nearAxis);
+#else
+	for (int i = 0; i < VD_RAY_PACKET; i++)
+	{
+		float nearT = 0.0f;
+		float farT = FLT_MAX;
+		axis[i] = -1;
+		for (int a = 0; a < 3; a++)
+		{
+			float o = packet.origin[a][i];
+			float d = packet.direction[a][i];
+			float tMin, tMax;
+			if (d == 0.0f)
+			{
+				bool inside = o >= low[a] && o <= high[a];
+				tMin = inside ? -INFINITY : INFINITY;
+				tMax = inside ? INFINITY : -INFINITY;
+			}
+			else
+			{
+				float t0 = (low[a] - o) / d;
+				float t1 = (high[a] - o) / d;
+				tMin = VDMin(t0, t1);
+				tMax = VDMax(t0, t1);
+			}
+			if (tMin > nearT)
+			{
+				nearT = tMin;
+				axis[i] = a;
+			}
+			farT = VDMin(farT, tMax);
+		}
+		tNear[i] = nearT <= farT && nearT <= maxDistance ? nearT : FLT_MAX;
+	}
+#endif
+}
+
+// Shared by the AABB and OBB batches, pFrame is null for an axis aligned box
+VDuint VDRayCastBoxBatch(const VDVector3* origins, const VDVector3* directions, VDuint count, const VDVector3& center,
+	const VDVector3& halfExtents, const VDFrame* pFrame, float maxDistance, VDContactInfo* contacts)
+{
+	const float low[3] = { -halfExtents.x, -halfExtents.y, -halfExtents.z };
+	const float high[3] = { halfExtents.x, halfExtents.y, halfExtents.z };
+	VDuint hits = 0;
+	for (VDuint first = 0; first < count; first += VD_RAY_PACKET)
+	{
+		VDuint lanes = VDMin(count - first, (VDuint)VD_RAY_PACKET);
+		VDRayPacket packet;
+		for (VDuint i = 0; i < VD_RAY_PACKET; i++)
+		{
+			// Spare lanes repeat the last ray and are not written back
+			VDuint ray = first + VDMin(i, lanes - 1);
+			VDVector3 origin = pFrame != nullptr ? pFrame->localPosition(origins[ray], center) : origins[ray] - center;
+			VDVector3 direction = pFrame != nullptr ? pFrame->localDirection(directions[ray]) : directions[ray];
+			packet.origin[0][i] = origin.x;
+			packet.origin[1][i] = origin.y;
+			packet.origin[2][i] = origin.z;
+			packet.direction[0][i] = direction.x;
+			packet.direction[1][i] = direction.y;
+			packet.direction[2][i] = direction.z;
+		}
+		float tNear[VD_RAY_PACKET];
+		int axis[VD_RAY_PACKET];
+		VDRayPacketSlab(packet, low, high, maxDistance, tNear, axis);
+		for (VDuint i = 0; i < lanes; i++)
+		{
+			VDContactInfo& contact = contacts[first + i];
+			contact.distance = tNear[i];
+			contact.normal = VDVector3();
+			if (tNear[i] == FLT_MAX)
+				continue;
+			hits++;
+			contact.point = origins[first + i] + directions[first + i] * tNear[i];
+			if (axis[i] >= 0)
+			{
+				float sign = packet.direction[axis[i]][i] > 0.0f ? -1.0f : 1.0f;
+				VDVector3 localNormal(axis[i] == 0 ? sign : 0.0f, axis[i] == 1 ? sign : 0.0f, axis[i] == 2 ? sign : 0.0f);
+				contact.normal = pFrame != nullptr ? pFrame->right * localNormal.x + pFrame->up * localNormal.y + pFrame->forward * localNormal.z : localNormal;
+			}
+		}
+	}
+	return hits;
+}
+
+// Tests count rays against aabb. contacts[i] gets the entry point, distance and face normal as
+// VDRayIntersectAABB gives them, misses get distance FLT_MAX. Returns the number of hits.
+VDuint VDRayCastAABBBatch(const VDVector3* origins, const VDVector3* directions, VDuint count, const VDAABB& aabb,
+	float maxDistance, VDContactInfo* contacts)
+{
+	return VDRayCastBoxBatch(origins, directions, count, aabb.position, aabb.halfExtents, nullptr, maxDistance, contacts);
+}
+
+// As VDRayCastAABBBatch in the frame of obb, normals are given in world space
+VDuint VDRayCastOBBBatch(const VDVector3* origins, const VDVector3* directions, VDuint count, const VDOBB& obb,
+	float maxDistance, VDContactInfo* contacts)
+{
+	return VDRayCastBoxBatch(origins, directions, count, obb.position, obb.halfExtents, &obb.frame, maxDistance, contacts);
+}
+
+// Runs castRay(i) for every ray, on the threads of pPool when given, and counts the hits
+template <typename F>
+VDuint VDRunRayBatch(VDuint count, VDWorkerPool* pPool, F castRay)
+{
+	std::atomic<VDuint> hitCount(0);
+	auto castRange = [&](VDuint begin, VDuint end)
+		{
+			VDuint rangeHits = 0;
+			for (VDuint i = begin; i < end; i++)
+				rangeHits += castRay(i);
+			hitCount += rangeHits;
+		};
+	if (pPool != nullptr)
+		pPool->parallelFor(count, VD_RAY_BATCH_GRAIN, castRange);
+	else
+		castRange(0, count);
+	return hitCount;
+}
+
+// Casts count rays through space as VDSpace::rayCast does. Misses leave hits[i].voxel invalid.
+// With a pool the rays are split across its threads, the space must not change meanwhile.
+// Returns the number of hits.
+VDuint VDRayCastBatch(const VDSpace& space, const VDVector3* origins, const VDVector3* directions, VDuint count,
+	float maxDistance, VDRayHit* hits, VDWorkerPool* pPool = nullptr)
+{
+	return VDRunRayBatch(count, pPool, [&](VDuint i)
+		{
+			hits[i] = VDRayHit();
+			return space.rayCast(origins[i], directions[i], maxDistance, hits[i]);
+		});
+}
+
+#endif
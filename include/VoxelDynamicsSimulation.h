@@ -7,22 +7,40 @@
 #include "VoxelDynamicsCollisionDetection.h"
 #include "VoxelDynamicsSpace.h"
 #include "VoxelDynamicsBody.h"
+#include "VoxelDynamicsStreaming.h"
+#include "VoxelDynamicsRayQuery.h"
+#include "VoxelDynamicsEdit.h"
+#include "VoxelDynamicsTerrain.h"
+#include <memory>
 
 struct VDSimulation
 {
 	VDSpace space;
-	VDList<VDBody*> pBodies;
-	VDList<VDBody> aabbBodies;
-	VDList<VDAgentController> agents;
+	// Dense body and agent storage, referred to from outside and from voxels by handle
+	VDBodyStore bodies;
+	VDSlotMap<VDAgentController> agents;
+	// Null unless enableStreaming was called
+	std::unique_ptr<VDChunkStreamer> streamer;
 	VDVector3 gravity;
 	float dtCap;
 	float frictionFactor = 0.15f;
+	// Chunks nothing sampled for this many steps are compressed, a few per step; 0 disables it
+	VDuint coldChunkSteps = 300;
+	VDuint maxChunksCompressedPerStep = 4;
+	// Bodies resting slower than this fall asleep
+	float sleepVelocity = 0.5f;
+	// Journal version up to which voxel edits have woken the bodies around them
+	uint64_t seenEditVersion = 0;
 
 	VDSimulation() : space(VDSpace())
 	{
-		pBodies = VDList<VDBody*>();
-		aabbBodies = VDList<VDBody>();
-		agents = VDList<VDAgentController>();
+		gravity = VDVector3(0, -9.81f, 0);
+		dtCap = 1.0f / 60.0f;
+	}
+
+	VDSimulation(VDuint gridSize, VDVector3i anchor) :
+		space(gridSize, anchor)
+	{
 		gravity = VDVector3(0, -9.81f, 0);
 		dtCap = 1.0f / 60.0f;
 	}
@@ -30,53 +48,161 @@ struct VDSimulation
 	VDSimulation(VDuint gridSize, VDVector3i anchor, VDuint horizontalGrids, VDuint verticalGrids) :
 		space(gridSize, anchor, horizontalGrids, verticalGrids)
 	{
-		pBodies = VDList<VDBody*>();
-		aabbBodies = VDList<VDBody>();
-		agents = VDList<VDAgentController>();
 		gravity = VDVector3(0, -9.81f, 0);
 		dtCap = 1.0f / 60.0f;
 	}
 
 
 
-	VDBody* createAABBBody(VDAABB aabb, float mass)
+	VDHandle createAABBBody(VDAABB aabb, float mass)
+	{
+		VDHandle handle = bodies.insert(aabb.position, aabb.halfExtents, mass);
+		VDuint index = bodies.count() - 1;
+		space.insertCollider(handle, bodies.getAABB(index), bodies.occupiedChunks[index]);
+		return handle;
+	}
+
+	VDBodyRef getBody(VDHandle handle)
+	{
+		VDuint index = bodies.table.denseIndex(handle);
+		if (index == VD_INVALID_HANDLE_INDEX)
+			return VDBodyRef();
+		return VDBodyRef(&bodies, index);
+	}
+
+	bool removeBody(VDHandle handle)
+	{
+		VDuint index = bodies.table.denseIndex(handle);
+		if (index == VD_INVALID_HANDLE_INDEX)
+			return false;
+		space.removeCollider(handle, bodies.occupiedChunks[index]);
+		return bodies.remove(handle);
+	}
+
+	VDHandle createAgentController(VDVector3 position, VDVector3 halfExtents, float speed)
+	{
+		VDHandle handle = agents.insert(VDAgentController(position, halfExtents, speed));
+		agents.get(handle)->handle = handle;
+		return handle;
+	}
+
+	VDAgentController* getAgentController(VDHandle handle)
+	{
+		return agents.get(handle);
+	}
+
+	bool removeAgentController(VDHandle handle)
+	{
+		return agents.remove(handle);
+	}
+
+	// Chunks around registered agents and awake bodies are loaded by loader on worker threads
+	// and evicted through saver once out of range and over the budget
+	void enableStreaming(const VDStreamingSettings& settings, VDChunkLoader loader, VDChunkSaver saver = VDChunkSaver())
+	{
+		streamer.reset(new VDChunkStreamer(settings, loader, saver, space.gridSize, space.anchor));
+	}
+
+	void addStreamingAgent(VDHandle agent)
 	{
-		VDBody* pBody = aabbBodies.insert(VDBody(aabb.position, aabb.halfExtents, mass));
-		space.insertCollider(*pBody);
-		pBodies.insert(pBody);
-		return pBody;
+		if (streamer)
+			streamer->addAgent(agent);
 	}
 
-	VDAgentController* createAgentController(VDVector3 position, VDVector3 halfExtents, float speed)
+	void removeStreamingAgent(VDHandle agent)
 	{
-		VDAgentController* pAgent = agents.insert(VDAgentController(position, halfExtents, speed));
-		return pAgent;
+		if (streamer)
+			streamer->removeAgent(agent);
 	}
 
-	void multiVoxelContactResolution(VDAABB& aabb, const VDList<VDVoxel*>& voxels, VDPenetrationField& penetrationsField, VDList<VDContactInfo>& contactPoints) const
+	// First voxel or body along the ray, see VDSpace::traceRay. Bodies are found through the
+	// collider lists of the voxels the ray crosses, so only bodies within chunks are hit.
+	bool rayCast(VDVector3 from, VDVector3 dir, float maxDistance, VDRayHit& hit) const
 	{
-		VDuint chunkIndex = 0;
+		float bodyDistance = FLT_MAX;
+		VDVector3 bodyNormal;
+		VDHandle body;
+		bool voxelHit = false;
+		space.traceRay(from, dir, maxDistance, true, [&](VDGrid* pChunk, VDuint index, VDVector3i coords, float distance, VDVector3 normal)
+			{
+				if (distance > bodyDistance)
+					return false;
+				const VDList<VDHandle>* pColliders = pChunk->voxelColliders.count > 0 ? pChunk->voxelColliders.find(index) : nullptr;
+				for (auto it = pColliders != nullptr ? pColliders->pFirst : nullptr; it != nullptr; it = it->pNext)
+				{
+					VDuint bodyIndex = bodies.table.denseIndex(it->item);
+					float d;
+					VDVector3 n;
+					if (bodyIndex != VD_INVALID_HANDLE_INDEX && !(it->item == body)
+						&& VDRayIntersectAABB(from, dir, bodies.getAABB(bodyIndex), d, n) && d < bodyDistance && d <= maxDistance)
+					{
+						bodyDistance = d;
+						bodyNormal = n;
+						body = it->item;
+					}
+				}
+				if (distance > bodyDistance || !pChunk->getOccupied(index))
+					return true;
+				hit.voxel = pChunk->voxelRef(index);
+				hit.coords = coords;
+				hit.distance = distance;
+				hit.point = from + dir * distance;
+				hit.normal = normal;
+				hit.collider = VDHandle();
+				voxelHit = true;
+				return false;
+			});
+		if (voxelHit)
+			return true;
+		if (body.isNull())
+			return false;
+		hit.voxel = VDVoxelRef();
+		hit.coords = VDVector3i();
+		hit.distance = bodyDistance;
+		hit.point = from + dir * bodyDistance;
+		hit.normal = bodyNormal;
+		hit.collider = body;
+		return true;
+	}
+
+	// rayCast for count rays, misses leave both hits[i].voxel and hits[i].collider unset.
+	// With a pool the rays are split across its threads. Returns the number of hits.
+	VDuint rayCastBatch(const VDVector3* origins, const VDVector3* directions, VDuint count, float maxDistance, VDRayHit* hits, VDWorkerPool* pPool = nullptr) const
+	{
+		return VDRunRayBatch(count, pPool, [&](VDuint i)
+			{
+				hits[i] = VDRayHit();
+				return rayCast(origins[i], directions[i], maxDistance, hits[i]);
+			});
+	}
+
+	void multiVoxelContactResolution(VDAABB& aabb, const VDList<VDVoxelRef>& voxels, VDPenetrationField& penetrationsField, VDSmallVector<VDContactInfo, 6>& contactPoints) const
+	{
+		VDuint chunkIndex = VD_INVALID_HANDLE_INDEX;
 		VDVector3i chunkCoords;
 		for (auto voxelListData = voxels.pFirst; voxelListData != nullptr; voxelListData = voxelListData->pNext)
 		{
-			if (voxelListData->item->chunkIndex != chunkIndex)
+			if (voxelListData->item.chunkIndex() != chunkIndex)
 			{
-				chunkIndex = voxelListData->item->chunkIndex;
+				chunkIndex = voxelListData->item.chunkIndex();
 				chunkCoords = space.getCoordinates(chunkIndex);
 			}
-			VDAABBContact c = voxelListData->item->voxelContact(aabb);
+			VDAABBContact c = voxelListData->item.voxelContact(aabb);
 			c.setPenetrations();
 			VDDirection minDirection = c.minDirections[0];
-			VDVector3i newVoxCoord = space.moveIndex(voxelListData->item->index, chunkCoords, minDirection);
-			bool valid = space.validateChunkCoord(chunkCoords) && space.grids[chunkIndex].pChunk->validateCoords(newVoxCoord);
+			// moveIndex steps the chunk coordinates when the neighbour lies across a chunk border
+			VDVector3i neighbourChunk = chunkCoords;
+			VDVector3i newVoxCoord = space.moveIndex(voxelListData->item.index, neighbourChunk, minDirection);
+			bool valid = space.validateChunkCoord(neighbourChunk) && space.grids[chunkIndex].pChunk->validateCoords(newVoxCoord);
 			VDuint newVoxIndex = space.grids[chunkIndex].pChunk->getIndex(newVoxCoord);
 			bool occupied = !valid && space.grids[chunkIndex].pChunk->getOccupied(newVoxIndex);
 			bool allOccupied = false;
 			if (occupied)
 			{
 				minDirection = c.minDirections[1];
-				newVoxCoord = space.moveIndex(voxelListData->item->index, chunkCoords, minDirection);
-				valid = space.validateChunkCoord(chunkCoords) && space.grids[chunkIndex].pChunk->validateCoords(newVoxCoord);
+				neighbourChunk = chunkCoords;
+				newVoxCoord = space.moveIndex(voxelListData->item.index, neighbourChunk, minDirection);
+				valid = space.validateChunkCoord(neighbourChunk) && space.grids[chunkIndex].pChunk->validateCoords(newVoxCoord);
 				newVoxIndex = space.grids[chunkIndex].pChunk->getIndex(newVoxCoord);
 				occupied = !valid && space.grids[chunkIndex].pChunk->getOccupied(newVoxIndex);
 				if (occupied)
@@ -87,7 +213,7 @@ struct VDSimulation
 			if (!allOccupied)
 			{
 				float penetration = c.getPenetrationByDirection(minDirection);
-				penetrationsField.insertPenetration(minDirection, penetration, voxelListData->item);
+				penetrationsField.insertPenetration(minDirection, penetration, (VDPointer)&voxelListData->item.readVoxel());
 			}
 		}
 		for (int i = 0; i < 6; i++)
@@ -104,13 +230,17 @@ struct VDSimulation
 		agent.forces.insert(gravity);
 		agent.simulate(dt);
 
-		VDList<VDPointer> uniqueColliders(true);
-		VDList<VDVoxel*> sampledVoxels(true);
+		VDList<VDHandle> uniqueColliders(&VDFrameArena::local());
+		VDList<VDVoxelRef> sampledVoxels(&VDFrameArena::local());
 		space.sampleOccupiedRegion(agent, sampledVoxels, uniqueColliders);
 		for (auto it = uniqueColliders.pFirst; it != nullptr; it = it->pNext)
 		{
 			VDAABBContact contact;
-			if (agent.collisionAABB((VDAABB*)it->item, contact))
+			VDuint other = bodies.table.denseIndex(it->item);
+			if (other == VD_INVALID_HANDLE_INDEX)
+				continue;
+			VDAABB otherAABB = bodies.getAABB(other);
+			if (agent.collisionAABB(&otherAABB, contact))
 			{
 				agent.resolveAABBContact(contact);
 				if (contact.minDirections[0] == VDDirection::UP)
@@ -121,11 +251,11 @@ struct VDSimulation
 			}
 		}
 		VDPenetrationField field;
-		VDList<VDContactInfo> voxelContactPoints(true);
+		VDSmallVector<VDContactInfo, 6> voxelContactPoints;
 		multiVoxelContactResolution(agent, sampledVoxels, field, voxelContactPoints);
-		for (auto it = voxelContactPoints.pFirst; it != nullptr; it = it->pNext)
+		for (VDuint i = voxelContactPoints.count; i > 0; i--)
 		{
-			agent.translate(it->item.normal*it->item.distance);
+			agent.translate(voxelContactPoints[i - 1].normal * voxelContactPoints[i - 1].distance);
 		}
 		if (field.maxPenetrations[VDDirection::UP] > 0.0f)
 		{
@@ -138,112 +268,254 @@ struct VDSimulation
 
 	void simulateAgents(float dt)
 	{
-		for (auto agentIt = agents.pFirst; agentIt != nullptr; agentIt = agentIt->pNext)
-			updateAgent(agentIt->item, space, dt);
+		for (VDuint i = 0; i < agents.count(); i++)
+		{
+			// Keeps the chunks under agents dense, updateAgent only reads the space
+			space.touchRegion(agents[i]);
+			updateAgent(agents[i], space, dt);
+		}
 	}
 
-	void resolveAABBStaticBodyContact(VDBody* pBody, const VDContactInfo& contactPoint, float dt)
+	void resolveAABBStaticBodyContact(VDuint body, const VDContactInfo& contactPoint, float dt)
 	{
-		pBody->translate(contactPoint.normal * contactPoint.distance);
-		VDVector3 vn = contactPoint.normal * VDDot(contactPoint.normal, pBody->velocity) * -1.0f;
-		pBody->deltaMomentums.insert(vn * pBody->mass * pBody->restitution );
-		VDVector3 normalVelocity = VDNormalComponent(pBody->velocity, contactPoint.normal);
-		VDVector3 frictionDir = pBody->velocity - normalVelocity;
+		bodies.positions[body] += contactPoint.normal * contactPoint.distance;
+		VDVector3 velocity = bodies.velocities[body];
+		float mass = bodies.masses[body];
+		VDVector3 vn = contactPoint.normal * VDDot(contactPoint.normal, velocity) * -1.0f;
+		bodies.deltaMomentums[body] += vn * mass * bodies.restitutions[body];
+		VDVector3 normalVelocity = VDNormalComponent(velocity, contactPoint.normal);
+		VDVector3 frictionDir = velocity - normalVelocity;
 		frictionDir.normalize();
 		frictionDir = frictionDir * -1.0f;
 		
-		float vMag = pBody->velocity.length();
+		float vMag = velocity.length();
 		if(frictionDir.length()>0.0f)
-			pBody->deltaMomentums.insert(frictionDir * vMag * pBody->mass * pBody->friction * frictionFactor );
-		if (vMag < 0.5f && contactPoint.normal.y > 0.0f)
-			pBody->setSleeping(true);
+			bodies.deltaMomentums[body] += frictionDir * vMag * mass * bodies.frictions[body] * frictionFactor;
+		if (vMag < sleepVelocity && contactPoint.normal.y > 0.0f)
+			bodies.setSleeping(body, true);
 	}
 
-	void resolveAABBDynamicBodyContact(VDBody* pBody, VDBody* pOtherBody, const VDContactInfo& contactPoint, float dt)
+	void resolveAABBDynamicBodyContact(VDuint body, VDuint otherBody, const VDContactInfo& contactPoint, float dt)
 	{
-		pBody->translate(contactPoint.normal * contactPoint.distance *0.5f);
-		pOtherBody->translate(contactPoint.normal * -contactPoint.distance * 0.5f);
+		bodies.positions[body] += contactPoint.normal * contactPoint.distance *0.5f;
+		bodies.positions[otherBody] += contactPoint.normal * -contactPoint.distance * 0.5f;
 
-		VDVector3 vRel = (pOtherBody->velocity - pBody->velocity);
+		VDVector3 vRel = (bodies.velocities[otherBody] - bodies.velocities[body]);
 		VDVector3 vn = contactPoint.normal * VDDot(contactPoint.normal, vRel);
 
 		float vMag = vRel.length();
 		float vnMag = vn.length();
 		
-		if (vMag < 0.5f)
+		if (vMag < sleepVelocity)
 		{
 			if(contactPoint.normal.y > 0.0f)
-				pBody->setSleeping(true);
+				bodies.setSleeping(body, true);
 		}
 		else
 		{
-			if (pOtherBody->sleeping)
-				pOtherBody->setSleeping(false);
-			pBody->deltaMomentums.insert(vn * pBody->mass * pBody->restitution);
-			pOtherBody->deltaMomentums.insert(vn * pBody->mass * -pBody->restitution);
+			if (bodies.sleeping[otherBody])
+				bodies.setSleeping(otherBody, false);
+			float mass = bodies.masses[body];
+			float restitution = bodies.restitutions[body];
+			float friction = bodies.frictions[body];
+			bodies.deltaMomentums[body] += vn * mass * restitution;
+			bodies.deltaMomentums[otherBody] += vn * mass * -restitution;
 
 			//VDVector3 normalVelocity = VDNormalComponent(vRel, contactPoint.normal);
 			VDVector3 frictionDir = vRel - vn;
 			frictionDir.normalize();
 			frictionDir = frictionDir;
-			pBody->deltaMomentums.insert(frictionDir * vnMag * pBody->mass * pBody->friction * frictionFactor);
-			pOtherBody->deltaMomentums.insert(frictionDir * vnMag * -pBody->mass * pBody->friction * frictionFactor);
+			bodies.deltaMomentums[body] += frictionDir * vnMag * mass * friction * frictionFactor;
+			bodies.deltaMomentums[otherBody] += frictionDir * vnMag * -mass * friction * frictionFactor;
+		}
+	}
+
+	void collideBody(VDuint body, float dt)
+	{
+		VDList<VDHandle> uniqueColliders(&VDFrameArena::local());
+		VDList<VDVoxelRef> sampledVoxels(&VDFrameArena::local());
+		space.touchRegion(bodies.getAABB(body));
+		space.sampleOccupiedRegion(bodies.getAABB(body), sampledVoxels, uniqueColliders, 0.005f);
+		bool hasIntersection = false;
+		for (auto collIt = uniqueColliders.pFirst; collIt != nullptr; collIt = collIt->pNext)
+		{
+			VDuint otherBody = bodies.table.denseIndex(collIt->item);
+			if (otherBody != VD_INVALID_HANDLE_INDEX && otherBody != body)
+			{
+				VDAABB aabb = bodies.getAABB(body);
+				VDAABB otherAABB = bodies.getAABB(otherBody);
+				VDAABB intersectionRegion;
+				bool doesIntersect = aabb.intersectionRegion(otherAABB, intersectionRegion);
+				if (doesIntersect)
+				{
+					VDVector3 quadrantDir = VDSign(aabb.position - otherAABB.position);
+					VDAABBContact contact(VDPointer(), VDPointer(), intersectionRegion, quadrantDir);
+					contact.setPenetrations();
+					VDContactInfo contactPoint(intersectionRegion.position,
+						VDDirectionToVector(contact.minDirections[0]), contact.getPenetrationByDirection(contact.minDirections[0]));
+					resolveAABBDynamicBodyContact(body, otherBody, contactPoint, dt);
+					if (contact.intersectionRegion.position.y < aabb.position.y && contact.intersectionRegion.crossSection(VDDirection::UP)>0.05f)
+						hasIntersection = true;
+				}
+			}
+		}
+		if (!hasIntersection && sampledVoxels.count == 0)
+		{
+			bodies.sleeping[body] = false;
+		}
+		VDPenetrationField field;
+		VDSmallVector<VDContactInfo, 6> voxelContactPoints;
+		VDAABB aabb = bodies.getAABB(body);
+		multiVoxelContactResolution(aabb, sampledVoxels, field, voxelContactPoints);
+		// Last direction first, the order the contact list used to hand them to the sequential solver
+		for (VDuint i = voxelContactPoints.count; i > 0; i--)
+		{
+			resolveAABBStaticBodyContact(body, voxelContactPoints[i - 1], dt);
 		}
 	}
 
 	void simulateBodies(float dt)
 	{
-		for (auto it = pBodies.pFirst; it != nullptr; it = it->pNext)
+		// Forces do not depend on contacts, so they go in for all bodies at once. Each body is
+		// then moved right before its contacts are resolved and later bodies see the corrections;
+		// moving all bodies up front makes stacks jitter
+		bodies.applyForces(gravity, dt);
+		for (VDuint i = 0; i < bodies.count(); i++)
 		{
-			if(it->item->useGravity && !it->item->sleeping)
-				it->item->forces.insert(gravity*it->item->mass);
-			it->item->simulate(dt);
-			space.updateCollider(*it->item);
+			bodies.integrate(i, dt);
+			space.updateCollider(bodies.table.handleAt(i), bodies.getAABB(i), bodies.occupiedChunks[i]);
+			collideBody(i, dt);
+		}
+	}
 
+	// Wakes the sleeping bodies registered in the voxels from low to high, world voxel coordinates
+	void wakeBodiesInRegion(VDVector3i low, VDVector3i high)
+	{
+		int size = (int)space.gridSize;
+		VDVector3i lowChunk = space.getChunkCoord(VDVector3(low) + VDVector3::half());
+		VDVector3i highChunk = space.getChunkCoord(VDVector3(high) + VDVector3::half());
+		for (int z = lowChunk.z; z <= highChunk.z; z++)
+		{
+			for (int y = lowChunk.y; y <= highChunk.y; y++)
+			{
+				for (int x = lowChunk.x; x <= highChunk.x; x++)
+				{
+					// Chunks with colliders are never compressed, so the mask can be read as is
+					VDuint slot = space.getIndex(VDVector3i(x, y, z));
+					if (slot == VD_INVALID_HANDLE_INDEX || space.grids[slot].pChunk->voxelColliders.count == 0)
+						continue;
+					VDGrid* pChunk = space.grids[slot].pChunk;
+					VDVector3i chunkLow = space.getChunkLow(VDVector3i(x, y, z));
+					VDVector3i lowInd = VDMax(low - chunkLow, VDVector3i(0, 0, 0));
+					VDVector3i highInd = VDMin(high - chunkLow, VDVector3i(size - 1, size - 1, size - 1));
+					pChunk->forEachSetBit(pChunk->colliderMask, lowInd, highInd, [&](VDuint index)
+						{
+							const VDList<VDHandle>* pColliders = pChunk->voxelColliders.find(index);
+							for (auto it = pColliders->pFirst; it != nullptr; it = it->pNext)
+							{
+								VDuint body = bodies.table.denseIndex(it->item);
+								if (body != VD_INVALID_HANDLE_INDEX)
+									bodies.sleeping[body] = false;
+							}
+						});
+				}
+			}
+		}
+	}
 
-			VDList<VDPointer> uniqueColliders(true);
-			VDList<VDVoxel*> sampledVoxels(true);
-			space.sampleOccupiedRegion(*it->item, sampledVoxels, uniqueColliders, 0.005f);
-			VDCollider* pThis = (VDCollider*)it->item;
-			bool hasIntersection = false;
-			for (auto collIt = uniqueColliders.pFirst; collIt != nullptr; collIt = collIt->pNext)
+	// Wakes the bodies around voxels edited since the last step. Bodies resting on a voxel are
+	// registered in the voxels next to it, so each edit reaches one voxel further. Chunks that
+	// are only loaded or evicted wake nobody.
+	void wakeEditedBodies()
+	{
+		VDChangeJournal& journal = *space.journal;
+		if (journal.version == seenEditVersion)
+			return;
+		// A journal that keeps nothing can not say what changed, edits then leave sleeping bodies alone
+		if (journal.capacity == 0)
+		{
+			seenEditVersion = journal.version;
+			return;
+		}
+		VDVector3i one(1, 1, 1);
+		bool complete = journal.pull(seenEditVersion, [&](const VDChunkChange& change)
 			{
-				VDCollider* pAABBCollider = collIt->item;
-				if (pThis != pAABBCollider)
+				VDVector3i chunkLow = space.getChunkLow(change.chunkCoord);
+				if (change.type == VD_CHANGE_VOXEL)
 				{
-					VDAABB intersectionRegion;
-					bool doesIntersect = it->item->intersectionRegion(*pAABBCollider, intersectionRegion);
-					if (doesIntersect)
-					{
-						VDVector3 quadrantDir = VDSign(it->item->position - pAABBCollider->position);
-						VDAABBContact contact((VDPointer)it->item, (VDPointer)collIt->item, intersectionRegion, quadrantDir);
-						contact.setPenetrations();
-						VDContactInfo contactPoint(intersectionRegion.position,
-							VDDirectionToVector(contact.minDirections[0]), contact.getPenetrationByDirection(contact.minDirections[0]));
-						resolveAABBDynamicBodyContact(it->item, collIt->item, contactPoint, dt);
-						if (contact.intersectionRegion.position.y < it->item->position.y && contact.intersectionRegion.crossSection(VDDirection::UP)>0.05f)
-							hasIntersection = true;
-					}
+					VDVector3i voxel = chunkLow + VDVector3i(change.index % space.gridSize,
+						(change.index / space.gridSize) % space.gridSize, change.index / (space.gridSize * space.gridSize));
+					wakeBodiesInRegion(voxel - one, voxel + one);
+				}
+				else if (change.type == VD_CHANGE_REGION)
+				{
+					wakeBodiesInRegion(chunkLow + change.low - one, chunkLow + change.high + one);
 				}
+			});
+		// Edits were dropped from the journal unseen, any body may have lost its support
+		if (!complete)
+		{
+			for (VDuint i = 0; i < bodies.count(); i++)
+				bodies.sleeping[i] = false;
+		}
+	}
+
+	// Runs at the start of a step while no query holds on to chunks
+	void streamChunks()
+	{
+		std::vector<VDHandle>& focusAgents = streamer->agents;
+		for (size_t i = 0; i < focusAgents.size();)
+		{
+			VDAgentController* pAgent = agents.get(focusAgents[i]);
+			if (pAgent == nullptr)
+			{
+				focusAgents.erase(focusAgents.begin() + i);
+				continue;
 			}
-			if (!hasIntersection && sampledVoxels.count == 0)
+			streamer->addFocus(space.getChunkCoord(pAgent->position));
+			i++;
+		}
+		if (streamer->settings.followBodies)
+		{
+			for (VDuint i = 0; i < bodies.count(); i++)
 			{
-				it->item->sleeping = false;
+				if (!bodies.sleeping[i])
+					streamer->addFocus(space.getChunkCoord(bodies.positions[i]));
 			}
-			VDPenetrationField field;
-			VDList<VDContactInfo> voxelContactPoints(true);
-			multiVoxelContactResolution(*it->item, sampledVoxels, field, voxelContactPoints);
-			for (auto cpIt = voxelContactPoints.pFirst; cpIt != nullptr; cpIt = cpIt->pNext)
+		}
+
+		VDList<VDGrid*> adopted(&VDFrameArena::local());
+		streamer->update(space, adopted);
+		// Bodies already inside a chunk that just arrived register with it so others collide with them
+		VDVector3 halfChunk = VDVector3(1, 1, 1) * ((float)space.gridSize * 0.5f);
+		for (auto it = adopted.pFirst; it != nullptr; it = it->pNext)
+		{
+			VDAABB chunkBox = VDAABB::fromMidPointAndHalfExtents(halfChunk, it->item->low + halfChunk);
+			for (VDuint i = 0; i < bodies.count(); i++)
 			{
-				resolveAABBStaticBodyContact(it->item, cpIt->item, dt);
+				if (bodies.getAABB(i).isIntersecting(chunkBox))
+					space.updateCollider(bodies.table.handleAt(i), bodies.getAABB(i), bodies.occupiedChunks[i]);
 			}
 		}
+		adopted.free();
 	}
 
 	void simulate(float dt)
 	{
 		if (dt > dtCap)
 			dt = dtCap;
+		// Transient query and contact lists this thread built in the previous step are released here.
+		// Arenas of other threads are left alone, they may belong to another simulation or a query.
+		VDFrameArena::local().reset();
+#ifdef VD_ALLOCATOR_STATS
+		gAllocator.markFrame();
+#endif
+		if (streamer)
+			streamChunks();
+		space.step++;
+		if (coldChunkSteps > 0)
+			space.compressColdChunks(coldChunkSteps, maxChunksCompressedPerStep);
+		wakeEditedBodies();
 		simulateAgents(dt);
 		simulateBodies(dt);
 	}
@@ -4,134 +4,914 @@
 #include "VoxelDynamicsCollider.h"
 #include "VoxelDynamicsAllocator.h"
 #include <vector>
+#include <deque>
+#include <memory>
+#include <climits>
+#include <cfloat>
 
 struct VDGrid;
+
+// One cell of a chunk. Its position, coordinates and chunk follow from where it is stored,
+// occupancy lives in the owning VDGrid's bitset and collider membership and user data
+// in its side tables.
 struct VDVoxel
 {
-	VDVector3i offsets;
-	bool occupied;
-	VDVector3 lowPosition;
-	VDPointer userData;
-	VDuint index;
-	VDuint chunkIndex;
-	VDList<VDPointer> colliders;
+	uint8_t material;
 
 	VDVoxel()
 	{
-		offsets = VDVector3i();
-		lowPosition = VDVector3();
-		occupied = false;
-		userData = NULL;
-		index = -1;
-		colliders = VDList<VDPointer>();
-		chunkIndex = 0;
+		material = 0;
+	}
+};
+
+// A voxel of a specific chunk, handed out by queries in place of a voxel pointer
+struct VDVoxelRef
+{
+	VDGrid* pChunk;
+	VDuint index;
+
+	VDVoxelRef()
+	{
+		pChunk = nullptr;
+		index = 0;
 	}
 
-	VDVoxel(VDVector3i _offsets, bool _occupied, VDVector3 _lowPosition, VDPointer _pointer, VDuint _index, VDuint _chunkIndex)
+	VDVoxelRef(VDGrid* _pChunk, VDuint _index)
 	{
-		offsets = _offsets;
-		occupied = _occupied;
-		lowPosition = _lowPosition;
-		userData = _pointer;
+		pChunk = _pChunk;
 		index = _index;
-		colliders = VDList<VDPointer>();
-		chunkIndex = _chunkIndex;
 	}
 
+	bool isValid() const
+	{
+		return pChunk != nullptr;
+	}
 
-	VDVoxel& operator=(const VDVoxel& other)
+	bool operator==(const VDVoxelRef& other) const
 	{
-		if (this != &other)
-		{
-			offsets = other.offsets;
-			occupied = other.occupied;
-			lowPosition = other.lowPosition;
-			userData = other.userData;
-			index = other.index;
-			colliders = other.colliders;
-			chunkIndex = other.chunkIndex;
-		}
-		return *this;
+		return pChunk == other.pChunk && index == other.index;
 	}
 
+	// Mutable access materializes a uniform chunk, readVoxel does not
+	VDVoxel& voxel() const;
+	const VDVoxel& readVoxel() const;
+	bool isOccupied() const;
+	void setOccupied(bool occupied) const;
+	VDuint chunkIndex() const;
+	VDVector3i offsets() const;
+	VDVector3 lowPosition() const;
+	VDPointer getUserData() const;
+	void setUserData(VDPointer userData) const;
+
 	VDVector3 midPoint() const
 	{
-		return lowPosition + VDVector3::half();
+		return lowPosition() + VDVector3::half();
 	}
 
-
 	VDAABB toAABB() const
 	{
-		return VDAABB(lowPosition, lowPosition + VDVector3::one());
+		VDVector3 low = lowPosition();
+		return VDAABB(low, low + VDVector3::one());
 	}
 
-	VDAABBContact voxelContact(VDAABB& aabb)
+	VDAABBContact voxelContact(VDAABB& aabb) const
 	{
 		VDAABB voxelAABB = toAABB();
 		VDAABB intersection;
 		aabb.intersectionRegion(voxelAABB, intersection);
 		VDVector3 quadrantDir = VDSign(aabb.position - voxelAABB.position);
-		return VDAABBContact((VDPointer)&aabb, (VDPointer)this, intersection, quadrantDir);
+		return VDAABBContact((VDPointer)&aabb, (VDPointer)&readVoxel(), intersection, quadrantDir);
 	}
 };
 
 
+// Uniform states of a chunk, an empty or solid chunk of a single material keeps no per-voxel
+// storage until its first heterogeneous edit
+#define VD_CHUNK_MIXED 0
+#define VD_CHUNK_EMPTY 1
+#define VD_CHUNK_SOLID 2
+
+// Voxels per brick edge as a shift, a brick is the cell of the occupancy summary
+#define VD_BRICK_SHIFT 2
+#define VD_BRICK_SIZE (1 << VD_BRICK_SHIFT)
+
+// Chunk sizes that are powers of two index voxels with shifts and masks, others multiply and divide
+#define VD_NO_GRID_SHIFT 0xFFFFFFFFu
+
+VDuint VDGridShift(VDuint gridSize)
+{
+	return gridSize != 0 && (gridSize & (gridSize - 1)) == 0 ? VDHighestBit(gridSize) : VD_NO_GRID_SHIFT;
+}
+
+// Storage of a cold chunk. Occupancy is kept as runs of equal words, materials as a
+// palette plus bit packed indices, which take no room when there is a single material.
+struct VDCompressedChunk
+{
+	// Index one past the last word of each run, ascending so a word's run can be searched for
+	std::vector<uint32_t> runEnds;
+	std::vector<uint64_t> runWords;
+	std::vector<VDVoxel> palette;
+	VDuint indexBits;
+	std::vector<uint64_t> packedIndices;
+	// The chunk's brick summary kept through compression, so traces cross empty bricks without decoding runs
+	std::vector<uint64_t> brickOccupancy;
+};
+
+// Kinds of VDChunkChange
+#define VD_CHANGE_VOXEL 0
+#define VD_CHANGE_REGION 1
+#define VD_CHANGE_CHUNK_ADDED 2
+#define VD_CHANGE_CHUNK_REMOVED 3
+
+// Changes a space journal keeps by default
+#define VD_JOURNAL_CAPACITY 65536
+
+struct VDChunkChange
+{
+	// Version of the journal this change created
+	uint64_t version;
+	VDVector3i chunkCoord;
+	uint8_t type;
+	// VD_CHANGE_VOXEL, the voxel's state before and after
+	VDuint index;
+	bool wasOccupied;
+	bool occupied;
+	VDVoxel oldVoxel;
+	VDVoxel newVoxel;
+	// VD_CHANGE_REGION, voxels of many edits at once in chunk coordinates, both bounds inclusive.
+	// Their previous state is not kept, consumers rescan the region.
+	VDVector3i low;
+	VDVector3i high;
+};
+
+// Append only record of the changes made to the chunks of a space. Every change bumps the
+// version by one, subscribers remember the last version they saw and pull what came after it.
+// Only the latest capacity changes are kept, older ones are dropped.
+struct VDChangeJournal
+{
+	std::deque<VDChunkChange> changes;
+	// Version of the latest change, 0 before the first one
+	uint64_t version;
+	// 0 keeps no changes, only the version counts on. VDSimulation then does not wake bodies on edits.
+	VDuint capacity;
+	VDVector3i anchor;
+	VDuint gridSize;
+
+	VDChangeJournal(VDVector3i _anchor, VDuint _gridSize)
+	{
+		version = 0;
+		capacity = VD_JOURNAL_CAPACITY;
+		anchor = _anchor;
+		gridSize = _gridSize;
+	}
+
+	// Starts the next version for the chunk whose low corner is chunkLow, null when nothing is kept
+	VDChunkChange* append(VDVector3 chunkLow, uint8_t type)
+	{
+		version++;
+		if (capacity == 0)
+			return nullptr;
+		if (changes.size() >= capacity)
+			changes.pop_front();
+		changes.push_back(VDChunkChange());
+		VDChunkChange& change = changes.back();
+		change.version = version;
+		change.chunkCoord = (VDVector3i(chunkLow) - anchor) / (int)gridSize;
+		change.type = type;
+		change.index = 0;
+		change.wasOccupied = false;
+		change.occupied = false;
+		return &change;
+	}
+
+	// Calls function(change) for the changes after seenVersion, oldest first, and moves seenVersion
+	// to the latest version. Returns false without calling function when some of those changes
+	// were already dropped, the subscriber has to rescan what it caches then.
+	template <typename F>
+	bool pull(uint64_t& seenVersion, F function) const
+	{
+		uint64_t firstKept = version - changes.size() + 1;
+		bool complete = seenVersion + 1 >= firstKept;
+		if (complete)
+		{
+			for (size_t i = seenVersion + 1 - firstKept; i < changes.size(); i++)
+				function(changes[i]);
+		}
+		seenVersion = version;
+		return complete;
+	}
+};
+
 struct VDGrid
 {
 	VDuint gridSize;
+	// log2 of gridSize, VD_NO_GRID_SHIFT when it is not a power of two
+	VDuint gridShift;
 	VDVoxel* voxels;
 	VDVector3 low;
 	VDuint indexCount;
 	VDuint chunkIndex;
 	VDPointer userData;
+	// One bit per voxel, each (y, z) row of voxels starts on a fresh word along x.
+	// Voxels and occupancy are null while the chunk is uniform.
+	// Write it through setOccupancy, or call rebuildBricks after writing it directly.
+	uint64_t* occupancy;
+	// Occupancy summary, one bit per brick of VD_BRICK_SIZE^3 voxels that holds any occupied voxel,
+	// bricks ordered x, y, z like voxels. occupiedBricks is the chunk level summary.
+	uint64_t* brickOccupancy;
+	VDuint brickAxis;
+	VDuint occupiedBricks;
+	// Same layout, set for voxels that have an entry in voxelColliders. Allocated with the first collider.
+	uint64_t* colliderMask;
+	VDuint rowWords;
+	// Keyed by voxel index, only voxels with colliders or user data have entries
+	VDHashMap<VDuint, VDList<VDHandle>> voxelColliders;
+	VDHashMap<VDuint, VDPointer> voxelUserData;
+	// Set while the chunk is compressed, voxels, occupancy and colliderMask are freed then.
+	// Const queries read it as is, every change expands the chunk first.
+	VDCompressedChunk* pCompressed;
+	// Step of the owning space in which the chunk was last touched, see VDSpace::touchChunk
+	uint64_t lastAccess;
+	// VD_CHUNK_*, uniformVoxel holds the material of every voxel of a uniform chunk
+	uint8_t uniform;
+	VDVoxel uniformVoxel;
+	// Journal of the owning space, null while the chunk is in none
+	VDChangeJournal* pJournal;
+	// Grows with every recorded change, to the journal version of the change while in a space
+	uint64_t version;
 
 	VDuint getIndex(VDuint lvx, VDuint lvy, VDuint lvz) const
 	{
+		if (gridShift != VD_NO_GRID_SHIFT)
+			return lvx + (lvy << gridShift) + (lvz << (gridShift * 2));
 		return lvx + lvy * gridSize + lvz * gridSize * gridSize;
 	}
 
+	// Negative coordinates wrap to large unsigned ones, so one compare per axis covers both bounds
 	bool validateCoords(VDVector3i coords) const
 	{
-		if (coords.x >= 0 && coords.x < gridSize && coords.y >= 0 && coords.y < gridSize && coords.z >= 0 && coords.z < gridSize)
-			return true;
-		return false;
+		return (VDuint)coords.x < gridSize && (VDuint)coords.y < gridSize && (VDuint)coords.z < gridSize;
 	}
 
 	VDVector3i getCoordinates(VDuint index) const
 	{
 		VDVector3i coords;
+		if (gridShift != VD_NO_GRID_SHIFT)
+		{
+			VDuint mask = gridSize - 1;
+			coords.x = index & mask;
+			coords.y = (index >> gridShift) & mask;
+			coords.z = index >> (gridShift * 2);
+			return coords;
+		}
 		coords.z = index / (gridSize * gridSize);
 		coords.y = (index % (gridSize * gridSize)) / gridSize;
 		coords.x = index % gridSize;
 		return coords;
 	}
 
+	// Row of the voxel at index, its (y, z) pair in the order rows are stored
+	VDuint getRow(VDuint index) const
+	{
+		return gridShift != VD_NO_GRID_SHIFT ? index >> gridShift : index / gridSize;
+	}
+
+
+	VDGrid(VDuint _chunkSize, VDVector3 low, VDuint _chunkIndex) : VDGrid(_chunkSize, low, _chunkIndex, VD_CHUNK_EMPTY)
+	{
+		materialize();
+	}
 
-	VDGrid(VDuint _chunkSize, VDVector3 low, VDuint _chunkIndex)
+	// A uniform chunk without per-voxel storage, VD_CHUNK_MIXED gives a dense empty chunk
+	VDGrid(VDuint _chunkSize, VDVector3 low, VDuint _chunkIndex, uint8_t _uniform, uint8_t material = 0)
 	{
 		gridSize = _chunkSize;
+		gridShift = VDGridShift(gridSize);
 		indexCount = gridSize * gridSize * gridSize;
+		rowWords = (gridSize + 63) / 64;
+		brickAxis = (gridSize + VD_BRICK_SIZE - 1) >> VD_BRICK_SHIFT;
+		voxels = nullptr;
+		occupancy = nullptr;
+		brickOccupancy = nullptr;
+		occupiedBricks = 0;
+		colliderMask = nullptr;
+		//aabb = VDAABB(low, low + VDVector3((float)gridSize, (float)gridSize, (float)gridSize));
+		this->low = low;
+		chunkIndex = _chunkIndex;
+		pCompressed = nullptr;
+		lastAccess = 0;
+		pJournal = nullptr;
+		version = 0;
+		uniform = _uniform == VD_CHUNK_MIXED ? VD_CHUNK_EMPTY : _uniform;
+		uniformVoxel.material = material;
+		if (_uniform == VD_CHUNK_MIXED)
+			materialize();
+	}
+
+	VDGrid() : VDGrid::VDGrid(25, VDVector3(), 0)
+	{
+		
+	}
+
+	void release()
+	{
+		voxelColliders.forEach([](const VDuint&, VDList<VDHandle>& colliders) { colliders.free(); });
+		voxelColliders.release();
+		voxelUserData.release();
+		freeVoxelStorage();
+		delete[] colliderMask;
+		delete pCompressed;
+		colliderMask = nullptr;
+		pCompressed = nullptr;
+	}
+
+	void freeVoxelStorage()
+	{
+		delete[] voxels;
+		delete[] occupancy;
+		delete[] brickOccupancy;
+		voxels = nullptr;
+		occupancy = nullptr;
+		brickOccupancy = nullptr;
+		occupiedBricks = 0;
+	}
+
+	VDuint wordCount() const
+	{
+		return rowWords * gridSize * gridSize;
+	}
+
+	VDuint brickWordCount() const
+	{
+		return (brickAxis * brickAxis * brickAxis + 63) / 64;
+	}
+
+	// Brick summary of a mixed chunk, read from the compressed storage while the chunk is compressed
+	const uint64_t* readBricks() const
+	{
+		return pCompressed != nullptr ? pCompressed->brickOccupancy.data() : brickOccupancy;
+	}
+
+	bool isCompressed() const
+	{
+		return pCompressed != nullptr;
+	}
+
+	bool isUniform() const
+	{
+		return uniform != VD_CHUNK_MIXED;
+	}
+
+	// Occupancy word of a full row segment, the last word of a row only covers the remaining voxels
+	uint64_t fullWord(VDuint word) const
+	{
+		VDuint tail = gridSize & 63;
+		return (word % rowWords == rowWords - 1 && tail != 0) ? (1ull << tail) - 1 : ~0ull;
+	}
+
+	// Gives a uniform chunk its per-voxel storage, needed before any heterogeneous edit
+	void materialize()
+	{
+		decompress();
+		if (uniform == VD_CHUNK_MIXED)
+			return;
+		VDuint words = wordCount();
 		voxels = new VDVoxel[indexCount];
-		for (VDuint x = 0; x < gridSize; ++x)
+		occupancy = new uint64_t[words];
+		for (VDuint i = 0; i < indexCount; i++)
+			voxels[i] = uniformVoxel;
+		for (VDuint i = 0; i < words; i++)
+			occupancy[i] = uniform == VD_CHUNK_SOLID ? fullWord(i) : 0;
+		uniform = VD_CHUNK_MIXED;
+		rebuildBricks();
+	}
+
+	// Drops the per-voxel storage of a dense chunk that turned out empty or solid of one material
+	bool makeUniform()
+	{
+		if (uniform != VD_CHUNK_MIXED || pCompressed != nullptr)
+			return false;
+		VDuint words = wordCount();
+		bool empty = true;
+		bool solid = true;
+		for (VDuint i = 0; i < words && (empty || solid); i++)
+		{
+			empty = empty && occupancy[i] == 0;
+			solid = solid && occupancy[i] == fullWord(i);
+		}
+		if (!empty && !solid)
+			return false;
+		for (VDuint i = 1; i < indexCount; i++)
+		{
+			if (voxels[i].material != voxels[0].material)
+				return false;
+		}
+		uniformVoxel = voxels[0];
+		uniform = empty ? VD_CHUNK_EMPTY : VD_CHUNK_SOLID;
+		freeVoxelStorage();
+		return true;
+	}
+
+	// Drops the voxel storage and gives every voxel the same state and material
+	void setUniform(bool solid, uint8_t material)
+	{
+		delete pCompressed;
+		pCompressed = nullptr;
+		freeVoxelStorage();
+		uniform = solid ? VD_CHUNK_SOLID : VD_CHUNK_EMPTY;
+		uniformVoxel.material = material;
+	}
+
+	// Moves the chunk to compressed storage, or to a uniform state when it is one.
+	// Chunks with registered colliders stay as they are.
+	bool compress()
+	{
+		if (pCompressed != nullptr || uniform != VD_CHUNK_MIXED || voxelColliders.count > 0)
+			return false;
+		delete[] colliderMask;
+		colliderMask = nullptr;
+		if (makeUniform())
+			return true;
+		VDCompressedChunk* pStorage = new VDCompressedChunk();
+		VDuint words = wordCount();
+		for (VDuint i = 0; i < words; i++)
 		{
-			for (VDuint y = 0; y < gridSize; ++y)
+			if (!pStorage->runWords.empty() && pStorage->runWords.back() == occupancy[i])
+				pStorage->runEnds.back() = i + 1;
+			else
 			{
-				for (VDuint z = 0; z < gridSize; ++z)
+				pStorage->runWords.push_back(occupancy[i]);
+				pStorage->runEnds.push_back(i + 1);
+			}
+		}
+
+		int16_t paletteIndex[256];
+		for (int i = 0; i < 256; i++)
+			paletteIndex[i] = -1;
+		for (VDuint i = 0; i < indexCount; i++)
+		{
+			uint8_t material = voxels[i].material;
+			if (paletteIndex[material] < 0)
+			{
+				paletteIndex[material] = (int16_t)pStorage->palette.size();
+				pStorage->palette.push_back(voxels[i]);
+			}
+		}
+		// Index widths dividing 64 keep every index inside one word
+		VDuint paletteSize = pStorage->palette.size();
+		pStorage->indexBits = paletteSize <= 1 ? 0 : paletteSize <= 2 ? 1 : paletteSize <= 4 ? 2 : paletteSize <= 16 ? 4 : 8;
+		if (pStorage->indexBits > 0)
+		{
+			VDuint perWord = 64 / pStorage->indexBits;
+			pStorage->packedIndices.assign((indexCount + perWord - 1) / perWord, 0);
+			for (VDuint i = 0; i < indexCount; i++)
+			{
+				uint64_t paletted = (uint64_t)paletteIndex[voxels[i].material];
+				pStorage->packedIndices[i / perWord] |= paletted << ((i % perWord) * pStorage->indexBits);
+			}
+		}
+		pStorage->runEnds.shrink_to_fit();
+		pStorage->runWords.shrink_to_fit();
+		pStorage->palette.shrink_to_fit();
+		pStorage->brickOccupancy.assign(brickOccupancy, brickOccupancy + brickWordCount());
+
+		freeVoxelStorage();
+		pCompressed = pStorage;
+		return true;
+	}
+
+	// Brings a compressed chunk back to its dense arrays, a no-op otherwise
+	void decompress()
+	{
+		if (pCompressed != nullptr)
+			expand();
+	}
+
+	void expand()
+	{
+		occupancy = new uint64_t[wordCount()];
+		voxels = new VDVoxel[indexCount];
+		expandInto(occupancy, voxels);
+		delete pCompressed;
+		pCompressed = nullptr;
+		rebuildBricks();
+	}
+
+	// Decodes a compressed chunk into wordCount() occupancy words and, unless null, indexCount voxels
+	void expandInto(uint64_t* words, VDVoxel* materials) const
+	{
+		const VDCompressedChunk* pStorage = pCompressed;
+		VDuint word = 0;
+		for (size_t run = 0; run < pStorage->runWords.size(); run++)
+		{
+			for (; word < pStorage->runEnds[run]; word++)
+				words[word] = pStorage->runWords[run];
+		}
+		if (materials == nullptr)
+			return;
+		if (pStorage->indexBits == 0)
+		{
+			std::fill_n(materials, indexCount, pStorage->palette.empty() ? VDVoxel() : pStorage->palette[0]);
+			return;
+		}
+		for (VDuint i = 0; i < indexCount; i++)
+			materials[i] = compressedVoxel(i);
+	}
+
+	// Occupancy word of a compressed chunk, read from its run
+	uint64_t compressedWord(VDuint word) const
+	{
+		const std::vector<uint32_t>& ends = pCompressed->runEnds;
+		return pCompressed->runWords[std::upper_bound(ends.begin(), ends.end(), word) - ends.begin()];
+	}
+
+	const VDVoxel& compressedVoxel(VDuint index) const
+	{
+		const VDCompressedChunk* pStorage = pCompressed;
+		if (pStorage->indexBits == 0)
+			return pStorage->palette[0];
+		VDuint perWord = 64 / pStorage->indexBits;
+		uint64_t mask = (1ull << pStorage->indexBits) - 1;
+		return pStorage->palette[(pStorage->packedIndices[index / perWord] >> ((index % perWord) * pStorage->indexBits)) & mask];
+	}
+
+	// Occupancy words to scan, decoded into scratch while the chunk is compressed
+	const uint64_t* readOccupancy(std::vector<uint64_t>& scratch) const
+	{
+		if (pCompressed == nullptr)
+			return occupancy;
+		scratch.resize(wordCount());
+		expandInto(scratch.data(), nullptr);
+		return scratch.data();
+	}
+
+	// Occupancy of the voxel at index in whatever way the chunk is stored, index must be valid
+	bool readOccupied(VDuint index) const
+	{
+		if (uniform != VD_CHUNK_MIXED)
+			return uniform == VD_CHUNK_SOLID;
+		if (pCompressed == nullptr)
+			return testBit(occupancy, index);
+		VDuint row = getRow(index);
+		VDuint x = index - row * gridSize;
+		return (compressedWord(row * rowWords + (x >> 6)) >> (x & 63)) & 1;
+	}
+
+	// Heap bytes held for voxel data, dense or compressed
+	size_t storageBytes() const
+	{
+		if (pCompressed != nullptr)
+		{
+			return sizeof(VDCompressedChunk) + pCompressed->runEnds.capacity() * sizeof(uint32_t)
+				+ pCompressed->runWords.capacity() * sizeof(uint64_t) + pCompressed->palette.capacity() * sizeof(VDVoxel)
+				+ pCompressed->packedIndices.capacity() * sizeof(uint64_t) + pCompressed->brickOccupancy.capacity() * sizeof(uint64_t);
+		}
+		size_t bytes = colliderMask != nullptr ? wordCount() * sizeof(uint64_t) : 0;
+		if (uniform == VD_CHUNK_MIXED)
+			bytes += indexCount * sizeof(VDVoxel) + (wordCount() + brickWordCount()) * sizeof(uint64_t);
+		return bytes;
+	}
+
+	VDuint rowWord(VDuint y, VDuint z) const
+	{
+		return (y + z * gridSize) * rowWords;
+	}
+
+	bool testBit(const uint64_t* bits, VDuint index) const
+	{
+		VDuint row = getRow(index);
+		VDuint x = index - row * gridSize;
+		return (bits[row * rowWords + (x >> 6)] >> (x & 63)) & 1;
+	}
+
+	void writeBit(uint64_t* bits, VDuint index, bool value)
+	{
+		VDuint row = getRow(index);
+		VDuint x = index - row * gridSize;
+		uint64_t bit = 1ull << (x & 63);
+		if (value)
+			bits[row * rowWords + (x >> 6)] |= bit;
+		else
+			bits[row * rowWords + (x >> 6)] &= ~bit;
+	}
+
+	VDuint brickIndex(VDuint bx, VDuint by, VDuint bz) const
+	{
+		return bx + (by + bz * brickAxis) * brickAxis;
+	}
+
+	// True if any bit from first to last of a flat bitset is set
+	static bool anyBitInRange(const uint64_t* bits, VDuint first, VDuint last)
+	{
+		VDuint firstWord = first >> 6;
+		VDuint lastWord = last >> 6;
+		for (VDuint w = firstWord; w <= lastWord; w++)
+		{
+			uint64_t word = bits[w];
+			if (w == firstWord)
+				word &= ~0ull << (first & 63);
+			if (w == lastWord)
+				word &= ~0ull >> (63 - (last & 63));
+			if (word != 0)
+				return true;
+		}
+		return false;
+	}
+
+	// Scans the occupancy rows of a brick, VD_BRICK_SIZE divides 64 so each row is one word
+	bool scanBrick(VDuint bx, VDuint by, VDuint bz) const
+	{
+		VDuint x = bx << VD_BRICK_SHIFT;
+		VDuint yEnd = VDMin((by + 1) << VD_BRICK_SHIFT, gridSize);
+		VDuint zEnd = VDMin((bz + 1) << VD_BRICK_SHIFT, gridSize);
+		for (VDuint z = bz << VD_BRICK_SHIFT; z < zEnd; z++)
+		{
+			for (VDuint y = by << VD_BRICK_SHIFT; y < yEnd; y++)
+			{
+				if ((occupancy[rowWord(y, z) + (x >> 6)] >> (x & 63)) & ((1ull << VD_BRICK_SIZE) - 1))
+					return true;
+			}
+		}
+		return false;
+	}
+
+	// Recomputes the summary from occupancy, for dense chunks only
+	void rebuildBricks()
+	{
+		if (occupancy == nullptr)
+			return;
+		if (brickOccupancy == nullptr)
+			brickOccupancy = new uint64_t[brickWordCount()];
+		memset(brickOccupancy, 0, brickWordCount() * sizeof(uint64_t));
+		occupiedBricks = 0;
+		for (VDuint bz = 0; bz < brickAxis; bz++)
+		{
+			for (VDuint by = 0; by < brickAxis; by++)
+			{
+				for (VDuint bx = 0; bx < brickAxis; bx++)
 				{
-					VDuint index = getIndex(x, y, z);
-					VDVector3i offsets = VDVector3i(x, y, z);
-					voxels[index] = VDVoxel(offsets, false, low + VDVector3(offsets), NULL, index, _chunkIndex);
+					if (scanBrick(bx, by, bz))
+					{
+						VDuint brick = brickIndex(bx, by, bz);
+						brickOccupancy[brick >> 6] |= 1ull << (brick & 63);
+						occupiedBricks++;
+					}
 				}
 			}
 		}
-		//aabb = VDAABB(low, low + VDVector3((float)gridSize, (float)gridSize, (float)gridSize));
-		this->low = low;
-		chunkIndex = _chunkIndex;
 	}
 
-	VDGrid() : VDGrid::VDGrid(25, VDVector3(), 0)
+	// Writes one occupancy bit and keeps the brick summary in step
+	void writeOccupancy(VDuint index, bool value)
 	{
-		
+		writeBit(occupancy, index, value);
+		VDVector3i coords = getCoordinates(index);
+		VDuint bx = coords.x >> VD_BRICK_SHIFT;
+		VDuint by = coords.y >> VD_BRICK_SHIFT;
+		VDuint bz = coords.z >> VD_BRICK_SHIFT;
+		VDuint brick = brickIndex(bx, by, bz);
+		uint64_t bit = 1ull << (brick & 63);
+		bool wasOccupied = (brickOccupancy[brick >> 6] & bit) != 0;
+		if (value && !wasOccupied)
+		{
+			brickOccupancy[brick >> 6] |= bit;
+			occupiedBricks++;
+		}
+		else if (!value && wasOccupied && !scanBrick(bx, by, bz))
+		{
+			brickOccupancy[brick >> 6] &= ~bit;
+			occupiedBricks--;
+		}
+	}
+
+	// Writes the voxels of mask in one occupancy word, filled voxels also take material.
+	// Returns the voxels that changed, the brick summary is left to refreshBricks.
+	uint64_t writeWord(VDuint word, uint64_t mask, bool fill, uint8_t material)
+	{
+		uint64_t old = occupancy[word];
+		occupancy[word] = fill ? old | mask : old & ~mask;
+		uint64_t changed = old ^ occupancy[word];
+		if (!fill)
+			return changed;
+		VDuint first = (word / rowWords) * gridSize + (word % rowWords) * 64;
+		for (uint64_t bits = mask; bits != 0; bits &= bits - 1)
+		{
+			VDuint bit = VDCountTrailingZeros(bits);
+			if (voxels[first + bit].material != material)
+			{
+				voxels[first + bit].material = material;
+				changed |= 1ull << bit;
+			}
+		}
+		return changed;
+	}
+
+	// Rescans the bricks overlapping the voxels from lowInd to highInd after direct writes
+	void refreshBricks(VDVector3i lowInd, VDVector3i highInd)
+	{
+		for (VDuint bz = lowInd.z >> VD_BRICK_SHIFT; bz <= (VDuint)highInd.z >> VD_BRICK_SHIFT; bz++)
+		{
+			for (VDuint by = lowInd.y >> VD_BRICK_SHIFT; by <= (VDuint)highInd.y >> VD_BRICK_SHIFT; by++)
+			{
+				for (VDuint bx = lowInd.x >> VD_BRICK_SHIFT; bx <= (VDuint)highInd.x >> VD_BRICK_SHIFT; bx++)
+				{
+					VDuint brick = brickIndex(bx, by, bz);
+					uint64_t bit = 1ull << (brick & 63);
+					bool wasOccupied = (brickOccupancy[brick >> 6] & bit) != 0;
+					if (wasOccupied == scanBrick(bx, by, bz))
+						continue;
+					brickOccupancy[brick >> 6] ^= bit;
+					occupiedBricks += wasOccupied ? -1 : 1;
+				}
+			}
+		}
+	}
+
+	// Journals a single voxel edit, the voxel's new state is read back from the chunk
+	void recordChange(VDuint index, bool wasOccupied, VDVoxel oldVoxel)
+	{
+		if (pJournal == nullptr)
+		{
+			version++;
+			return;
+		}
+		VDChunkChange* pChange = pJournal->append(low, VD_CHANGE_VOXEL);
+		version = pJournal->version;
+		if (pChange == nullptr)
+			return;
+		pChange->index = index;
+		pChange->wasOccupied = wasOccupied;
+		pChange->occupied = testBit(occupancy, index);
+		pChange->oldVoxel = oldVoxel;
+		pChange->newVoxel = voxels[index];
+	}
+
+	// Journals direct writes to the voxels from lowInd to highInd
+	void recordRegion(VDVector3i lowInd, VDVector3i highInd)
+	{
+		if (pJournal == nullptr)
+		{
+			version++;
+			return;
+		}
+		VDChunkChange* pChange = pJournal->append(low, VD_CHANGE_REGION);
+		version = pJournal->version;
+		if (pChange == nullptr)
+			return;
+		pChange->low = lowInd;
+		pChange->high = highInd;
+	}
+
+	// True when the chunk holds no occupied voxel, answered from the summaries
+	bool isEmpty() const
+	{
+		if (uniform != VD_CHUNK_MIXED)
+			return uniform == VD_CHUNK_EMPTY;
+		if (pCompressed != nullptr)
+			return std::all_of(pCompressed->runWords.begin(), pCompressed->runWords.end(), [](uint64_t word) { return word == 0; });
+		return occupiedBricks == 0;
+	}
+
+	// Clamps the voxels touched by aabb to the chunk, false when there are none
+	bool clampRegion(const VDAABB& aabb, VDVector3i& lowInd, VDVector3i& highInd) const
+	{
+		VDVector3 low = aabb.low - this->low;
+		if (low.x > gridSize || low.y > gridSize || low.z > gridSize)
+			return false;
+		VDVector3 high = aabb.high - this->low;
+		if (high.x < 0.0f || high.y < 0.0f || high.z < 0.0f)
+			return false;
+		lowInd = VDMax(VDVector3i(low), VDVector3i(0, 0, 0));
+		highInd = VDMin(VDVector3i(high), VDVector3i(gridSize - 1, gridSize - 1, gridSize - 1));
+		return lowInd.x <= highInd.x && lowInd.y <= highInd.y && lowInd.z <= highInd.z;
+	}
+
+	// Calls function(word, index of the word's first voxel) with every word of bits inside the
+	// region, masked to it, in index order. Rows of empty bricks are skipped when bits is the
+	// summarized occupancy. Stops early and returns false once function returns false.
+	template <typename F>
+	bool forEachRegionWord(const uint64_t* bits, VDVector3i lowInd, VDVector3i highInd, F function) const
+	{
+		bool summarized = bits == occupancy && brickOccupancy != nullptr;
+		if (summarized && occupiedBricks == 0)
+			return true;
+		VDuint firstWord = lowInd.x >> 6;
+		VDuint lastWord = highInd.x >> 6;
+		uint64_t firstMask = ~0ull << (lowInd.x & 63);
+		uint64_t lastMask = ~0ull >> (63 - (highInd.x & 63));
+		VDuint firstBrick = lowInd.x >> VD_BRICK_SHIFT;
+		VDuint lastBrick = highInd.x >> VD_BRICK_SHIFT;
+		for (int z = lowInd.z; z <= highInd.z; ++z)
+		{
+			VDuint bz = z >> VD_BRICK_SHIFT;
+			if (summarized && (z == lowInd.z || (z & (VD_BRICK_SIZE - 1)) == 0))
+			{
+				// Whole slab of bricks empty, step to the next brick layer
+				VDuint layerLow = brickIndex(firstBrick, lowInd.y >> VD_BRICK_SHIFT, bz);
+				VDuint layerHigh = brickIndex(lastBrick, highInd.y >> VD_BRICK_SHIFT, bz);
+				if (!anyBitInRange(brickOccupancy, layerLow, layerHigh))
+				{
+					z |= VD_BRICK_SIZE - 1;
+					continue;
+				}
+			}
+			for (int y = lowInd.y; y <= highInd.y; ++y)
+			{
+				if (summarized && (y == lowInd.y || (y & (VD_BRICK_SIZE - 1)) == 0))
+				{
+					VDuint by = y >> VD_BRICK_SHIFT;
+					if (!anyBitInRange(brickOccupancy, brickIndex(firstBrick, by, bz), brickIndex(lastBrick, by, bz)))
+					{
+						y |= VD_BRICK_SIZE - 1;
+						continue;
+					}
+				}
+				const uint64_t* row = bits + rowWord(y, z);
+				VDuint rowIndex = getIndex(0, y, z);
+				for (VDuint w = firstWord; w <= lastWord; w++)
+				{
+					uint64_t word = row[w];
+					if (w == firstWord)
+						word &= firstMask;
+					if (w == lastWord)
+						word &= lastMask;
+					if (!function(word, rowIndex + w * 64))
+						return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	// Calls function with the index of every set bit of bits inside the region, scanning
+	// whole words and stepping through their set bits
+	template <typename F>
+	void forEachSetBit(const uint64_t* bits, VDVector3i lowInd, VDVector3i highInd, F function) const
+	{
+		forEachRegionWord(bits, lowInd, highInd, [&](uint64_t word, VDuint wordIndex)
+			{
+				while (word != 0)
+				{
+					function(wordIndex + VDCountTrailingZeros(word));
+					word &= word - 1;
+				}
+				return true;
+			});
+	}
+
+	VDuint countSetBits(const uint64_t* bits, VDVector3i lowInd, VDVector3i highInd) const
+	{
+		VDuint count = 0;
+		forEachRegionWord(bits, lowInd, highInd, [&](uint64_t word, VDuint) { count += VDPopCount(word); return true; });
+		return count;
+	}
+
+	// Calls function with the index of every occupied voxel in the region in index order
+	template <typename F>
+	void forEachOccupied(VDVector3i lowInd, VDVector3i highInd, F function) const
+	{
+		if (uniform == VD_CHUNK_EMPTY)
+			return;
+		if (uniform == VD_CHUNK_MIXED)
+		{
+			std::vector<uint64_t> scratch;
+			forEachSetBit(readOccupancy(scratch), lowInd, highInd, function);
+			return;
+		}
+		for (int z = lowInd.z; z <= highInd.z; ++z)
+		{
+			for (int y = lowInd.y; y <= highInd.y; ++y)
+			{
+				VDuint index = getIndex(lowInd.x, y, z);
+				for (int x = lowInd.x; x <= highInd.x; ++x)
+					function(index++);
+			}
+		}
+	}
+
+	bool anyOccupied(VDAABB aabb) const
+	{
+		VDVector3i lowInd, highInd;
+		if (!clampRegion(aabb, lowInd, highInd))
+			return false;
+		if (uniform != VD_CHUNK_MIXED)
+			return uniform == VD_CHUNK_SOLID;
+		std::vector<uint64_t> scratch;
+		return !forEachRegionWord(readOccupancy(scratch), lowInd, highInd, [](uint64_t word, VDuint) { return word == 0; });
+	}
+
+	VDuint countOccupied(VDAABB aabb) const
+	{
+		VDVector3i lowInd, highInd;
+		if (!clampRegion(aabb, lowInd, highInd))
+			return 0;
+		if (uniform != VD_CHUNK_MIXED)
+		{
+			VDVector3i extent = highInd - lowInd + VDVector3i(1, 1, 1);
+			return uniform == VD_CHUNK_SOLID ? extent.x * extent.y * extent.z : 0;
+		}
+		std::vector<uint64_t> scratch;
+		return countSetBits(readOccupancy(scratch), lowInd, highInd);
 	}
 
 	VDuint getIndex(VDVector3 position) const
@@ -144,61 +924,82 @@ struct VDGrid
 	bool getOccupied(VDVector3 position) const
 	{
 		VDuint index = getIndex(position);
-		if (index < indexCount)
-			return voxels[index].occupied;
+		return index < indexCount && readOccupied(index);
 	}
 
 	bool getOccupied(VDuint lvx, VDuint lvy, VDuint lvz) const
 	{
 		VDuint index = getIndex(lvx, lvy, lvz);
-		if (index < indexCount)
-			return voxels[index].occupied;
+		return index < indexCount && readOccupied(index);
 	}
 
 	bool getOccupied(VDuint index) const
 	{
-		if (index < indexCount)
-			return voxels[index].occupied;
+		return index < indexCount && readOccupied(index);
 	}
 
-	VDVoxel* getVoxel(VDVector3 position)
+	VDVoxelRef voxelRef(VDuint index) const
+	{
+		return VDVoxelRef(const_cast<VDGrid*>(this), index);
+	}
+
+	VDVoxelRef getVoxel(VDVector3 position)
 	{
 		VDuint index = getIndex(position);
 		if (index < indexCount)
-			return &voxels[index];
+			return voxelRef(index);
+		return VDVoxelRef();
 	}
 
-	VDVoxel* getVoxel(VDuint lvx, VDuint lvy, VDuint lvz)
+	VDVoxelRef getVoxel(VDuint lvx, VDuint lvy, VDuint lvz)
 	{
 		VDuint index = getIndex(lvx, lvy, lvz);
 		if (index < indexCount)
-			return &voxels[index];
+			return voxelRef(index);
+		return VDVoxelRef();
 	}
 
-	VDVoxel* getVoxel(VDuint index)
+	VDVoxelRef getVoxel(VDuint index)
 	{
 		if (index < indexCount)
-			return &voxels[index];
+			return voxelRef(index);
+		return VDVoxelRef();
 	}
 
 
 
-	VDVoxel* setOccupied(VDuint index)
+	VDVoxelRef setOccupied(VDuint index)
 	{
-		if (index < indexCount && !voxels[index].occupied)
+		if (index >= indexCount || uniform == VD_CHUNK_SOLID)
+			return VDVoxelRef();
+		materialize();
+		if (!testBit(occupancy, index))
 		{
-			voxels[index].occupied = true;
-			return &voxels[index];
+			writeOccupancy(index, true);
+			recordChange(index, false, voxels[index]);
+			return voxelRef(index);
 		}
+		return VDVoxelRef();
+	}
+
+	void setOccupancy(VDuint index, bool occupied)
+	{
+		if (index >= indexCount || uniform == (occupied ? VD_CHUNK_SOLID : VD_CHUNK_EMPTY))
+			return;
+		materialize();
+		if (testBit(occupancy, index) == occupied)
+			return;
+		writeOccupancy(index, occupied);
+		recordChange(index, !occupied, voxels[index]);
 	}
 
-	VDVoxel* setOccupied(VDVector3 position)
+	VDVoxelRef setOccupied(VDVector3 position)
 	{
 		VDuint index = getIndex(position);
 		return setOccupied(index);
 	}
 
-	VDVoxel* setOccupied(VDuint lvx, VDuint lvy, VDuint lvz)
+	VDVoxelRef setOccupied(VDuint lvx, VDuint lvy, VDuint lvz)
 	{
 		VDuint index = getIndex(lvx, lvy, lvz);
 		return setOccupied(index);
@@ -206,10 +1007,28 @@ struct VDGrid
 
 	void setVoxel(VDuint index, VDVoxel voxel)
 	{
-		if (index < indexCount)
-		{
-			voxels[index] = voxel;
-		}
+		if (index >= indexCount || (uniform != VD_CHUNK_MIXED && voxel.material == uniformVoxel.material))
+			return;
+		materialize();
+		if (voxels[index].material == voxel.material)
+			return;
+		VDVoxel oldVoxel = voxels[index];
+		voxels[index] = voxel;
+		recordChange(index, testBit(occupancy, index), oldVoxel);
+	}
+
+	VDPointer getUserData(VDuint index) const
+	{
+		const VDPointer* pUserData = voxelUserData.find(index);
+		return pUserData != nullptr ? *pUserData : VDPointer();
+	}
+
+	void setUserData(VDuint index, VDPointer userData)
+	{
+		if (userData.value == 0)
+			voxelUserData.remove(index);
+		else
+			voxelUserData.insert(index, userData);
 	}
 
 	VDuint moveIndex(VDuint index, VDDirection direction) const
@@ -241,231 +1060,300 @@ struct VDGrid
 		return getIndex(coords.x, coords.y, coords.z);
 	}
 
-	VDList<VDVoxel*> sampleOccupiedRegion(VDAABB aabb) const
+	VDList<VDVoxelRef> sampleOccupiedRegion(VDAABB aabb) const
 	{
-		VDList<VDVoxel*> occupiedVoxels;
-		VDVector3 low = aabb.low - this->low;
-		if (low.x > gridSize || low.y > gridSize || low.z > gridSize)
-			return occupiedVoxels;
-		VDVector3 high = aabb.high - this->low;
-		if (high.x < 0.0f || high.y < 0.0f || high.z < 0.0f)
-			return occupiedVoxels;
-
-		VDVector3i lowInd = VDVector3i(low);
-		VDVector3i highInd = VDVector3i(high);
-		VDVector3i anchor = VDVector3i(this->low);
-
-		for (int x = lowInd.x; x <= highInd.x; ++x)
-		{
-			for (int y = lowInd.y; y <= highInd.y; ++y)
-			{
-				for (int z = lowInd.z; z <= highInd.z; ++z)
-				{
-					if (x >= 0 && y >= 0 && z >= 0 && x < gridSize && y < gridSize && z < gridSize)
-					{
-						VDuint index = getIndex(x, y, z);
-						if (index < indexCount && voxels[index].occupied)
-						{
-							occupiedVoxels.insert(&voxels[index]);
-						}
-					}
-				}
-			}
-		}
+		VDList<VDVoxelRef> occupiedVoxels;
+		VDVector3i lowInd, highInd;
+		if (clampRegion(aabb, lowInd, highInd))
+			forEachOccupied(lowInd, highInd, [&](VDuint index) { occupiedVoxels.insert(voxelRef(index)); });
 		return occupiedVoxels;
 	}
 
-	VDList<VDVoxel*> sampleRegion(VDAABB aabb) const
+	VDList<VDVoxelRef> sampleRegion(VDAABB aabb) const
 	{
-		VDList<VDVoxel*> occupiedVoxels;
-		VDVector3 low = aabb.low - this->low;
-		if (low.x > gridSize || low.y > gridSize || low.z > gridSize)
-			return occupiedVoxels;
-		VDVector3 high = aabb.high - this->low;
-		if (high.x < 0.0f || high.y < 0.0f || high.z < 0.0f)
-			return occupiedVoxels;
-
-		VDVector3i lowInd = VDVector3i(low);
-		VDVector3i highInd = VDVector3i(high);
-		VDVector3i anchor = VDVector3i(this->low);
+		VDList<VDVoxelRef> occupiedVoxels;
+		sampleRegion(aabb, occupiedVoxels);
+		return occupiedVoxels;
+	}
 
-		for (int x = lowInd.x; x <= highInd.x; ++x)
+	void sampleRegion(VDAABB aabb, VDList<VDVoxelRef>& occupiedVoxels) const
+	{
+		VDVector3i lowInd, highInd;
+		if (!clampRegion(aabb, lowInd, highInd))
+			return;
+		for (int z = lowInd.z; z <= highInd.z; ++z)
 		{
 			for (int y = lowInd.y; y <= highInd.y; ++y)
 			{
-				for (int z = lowInd.z; z <= highInd.z; ++z)
+				for (int x = lowInd.x; x <= highInd.x; ++x)
 				{
-					if (x >= 0 && y >= 0 && z >= 0 && x < gridSize && y < gridSize && z < gridSize)
-					{
-						VDuint index = getIndex(x, y, z);
-						if (index < indexCount)
-						{
-							occupiedVoxels.insert(&voxels[index]);
-						}
-					}
+					occupiedVoxels.insert(voxelRef(getIndex(x, y, z)));
 				}
 			}
 		}
-		return occupiedVoxels;
-	}
-
-	void sampleOccupiedRegion(VDAABB aabb, VDList<VDVoxel*>& occupiedVoxels, VDList<VDPointer>& uniqueColliders) const
-	{
-		VDVector3 low = aabb.low - this->low;
-		if (low.x > gridSize || low.y > gridSize || low.z > gridSize)
-			return;
-		VDVector3 high = aabb.high - this->low;
-		if (high.x < 0.0f || high.y < 0.0f || high.z < 0.0f)
-			return;
-
-		VDVector3i lowInd = VDVector3i(low);
-		VDVector3i highInd = VDVector3i(high);
-		VDVector3i anchor = VDVector3i(this->low);
+	}
 
-		for (int x = lowInd.x; x <= highInd.x; ++x)
+	// Compressed chunks have no colliders, their occupancy is decoded for the scan
+	void sampleOccupiedRegion(VDAABB aabb, VDList<VDVoxelRef>& occupiedVoxels, VDList<VDHandle>& uniqueColliders) const
+	{
+		VDVector3i lowInd, highInd;
+		if (!clampRegion(aabb, lowInd, highInd))
+			return;
+		if (voxelColliders.count > 0)
 		{
-			for (int y = lowInd.y; y <= highInd.y; ++y)
+			forEachSetBit(colliderMask, lowInd, highInd, [&](VDuint index)
 			{
-				for (int z = lowInd.z; z <= highInd.z; ++z)
+				const VDList<VDHandle>* pColliders = voxelColliders.find(index);
+				for (auto it = pColliders->pFirst; it != nullptr; it = it->pNext)
 				{
-					if (x >= 0 && y >= 0 && z >= 0 && x < gridSize && y < gridSize && z < gridSize)
-					{
-						VDuint index = getIndex(x, y, z);
-						if (index < indexCount)
-						{
-							if (voxels[index].colliders.count > 0)
-							{
-								for (auto it = voxels[index].colliders.pFirst; it != nullptr; it = it->pNext)
-								{
-									uniqueColliders.insertSortedUnique(it->item);
-								}
-							}
-							if(voxels[index].occupied)
-								occupiedVoxels.insert(&voxels[index]);
-						}
-					}
+					uniqueColliders.insertSortedUnique(it->item);
 				}
-			}
+			});
 		}
+		forEachOccupied(lowInd, highInd, [&](VDuint index) { occupiedVoxels.insert(voxelRef(index)); });
 	}
 
-	void insertCollider(VDCollider& collider, VDList<VDPointer>* occupiedVoxels)
+	void insertCollider(VDHandle handle, const VDAABB& bounds, VDList<VDuint>* occupiedVoxels)
 	{
-		VDList<VDVoxel*> sampled = sampleRegion(collider);
+		decompress();
+		if (colliderMask == nullptr)
+		{
+			colliderMask = new uint64_t[wordCount()];
+			memset(colliderMask, 0, wordCount() * sizeof(uint64_t));
+		}
+		VDList<VDVoxelRef> sampled(&VDFrameArena::local());
+		sampleRegion(bounds, sampled);
 		for (auto it = sampled.pFirst; it != nullptr; it = it->pNext)
 		{
-			it->item->colliders.insertSortedUnique(&collider);
-			occupiedVoxels->insertSortedUnique((VDPointer)it->item);
+			VDuint index = it->item.index;
+			VDList<VDHandle>* pColliders = voxelColliders.find(index);
+			if (pColliders == nullptr)
+			{
+				pColliders = voxelColliders.insert(index, VDList<VDHandle>());
+				writeBit(colliderMask, index, true);
+			}
+			pColliders->insertSortedUnique(handle);
+			occupiedVoxels->insertSortedUnique(index);
 		}
 		sampled.free();
 	}
 
-	void removeCollider(VDCollider& collider, VDList<VDPointer>* occupiedVoxels)
+	void removeCollider(VDHandle handle, VDList<VDuint>* occupiedVoxels)
 	{
+		decompress();
 		for (auto it = occupiedVoxels->pFirst; it != nullptr; it = it->pNext)
 		{
-			VDVoxel* pVoxel = (VDVoxel*)it->item;
-			pVoxel->colliders.removeSorted(&collider);
+			VDList<VDHandle>* pColliders = voxelColliders.find(it->item);
+			if (pColliders != nullptr)
+			{
+				pColliders->removeSorted(handle);
+				if (pColliders->count == 0)
+				{
+					voxelColliders.remove(it->item);
+					writeBit(colliderMask, it->item, false);
+				}
+			}
 		}
 		occupiedVoxels->free();
 	}
 
-	void updateCollider(VDCollider& collider, VDList<VDPointer>* occupiedVoxels)
+	void updateCollider(VDHandle handle, const VDAABB& bounds, VDList<VDuint>* occupiedVoxels)
 	{
-		removeCollider(collider, occupiedVoxels);
-		insertCollider(collider, occupiedVoxels);
+		removeCollider(handle, occupiedVoxels);
+		insertCollider(handle, bounds, occupiedVoxels);
 	}
 
-	VDList<VDVoxel*> getOccupiedVoxels()
+	VDList<VDVoxelRef> getOccupiedVoxels()
 	{
-		VDList<VDVoxel*> voxelList;
-		for (int i = 0; i < indexCount; i++)
+		decompress();
+		VDList<VDVoxelRef> voxelList;
+		if (indexCount > 0)
 		{
-			if (voxels[i].occupied)
-				voxelList.insert(&voxels[i]);
+			VDVector3i highInd(gridSize - 1, gridSize - 1, gridSize - 1);
+			forEachOccupied(VDVector3i(0, 0, 0), highInd, [&](VDuint index) { voxelList.insert(voxelRef(index)); });
 		}
 		return voxelList;
 	}
 
 };
 
+VDVoxel& VDVoxelRef::voxel() const
+{
+	pChunk->materialize();
+	return pChunk->voxels[index];
+}
+
+const VDVoxel& VDVoxelRef::readVoxel() const
+{
+	if (pChunk->isUniform())
+		return pChunk->uniformVoxel;
+	return pChunk->isCompressed() ? pChunk->compressedVoxel(index) : pChunk->voxels[index];
+}
+
+bool VDVoxelRef::isOccupied() const
+{
+	return pChunk->getOccupied(index);
+}
+
+void VDVoxelRef::setOccupied(bool occupied) const
+{
+	pChunk->setOccupancy(index, occupied);
+}
+
+VDuint VDVoxelRef::chunkIndex() const
+{
+	return pChunk->chunkIndex;
+}
+
+VDVector3i VDVoxelRef::offsets() const
+{
+	return pChunk->getCoordinates(index);
+}
+
+VDVector3 VDVoxelRef::lowPosition() const
+{
+	return pChunk->low + VDVector3(offsets());
+}
+
+VDPointer VDVoxelRef::getUserData() const
+{
+	return pChunk->getUserData(index);
+}
+
+void VDVoxelRef::setUserData(VDPointer userData) const
+{
+	pChunk->setUserData(index, userData);
+}
+
+// Result of a ray query against the voxels of a VDSpace
+struct VDRayHit
+{
+	VDVoxelRef voxel;
+	// Voxel coordinates relative to the space anchor
+	VDVector3i coords;
+	VDVector3 point;
+	// Outward normal of the face the ray entered through, zero when it started inside the voxel
+	VDVector3 normal;
+	float distance;
+	// Body hit before any voxel, found through the voxel collider lists, null otherwise
+	VDHandle collider;
+
+	VDRayHit()
+	{
+		coords = VDVector3i();
+		point = VDVector3();
+		normal = VDVector3();
+		distance = 0.0f;
+	}
+};
+
+// Chunks live in a sparse map keyed by integer chunk coordinates relative to the anchor,
+// so the world has no bounds and only costs memory where chunks have been created.
+// Coordinates may be negative. A chunk keeps its slot in grids for its whole lifetime,
+// which is the chunkIndex stored in VDGrid and the index of its handle.
 struct VDSpace
 {
 	struct VDChunkOccupation
 	{
 		bool occupied = false;
 		VDGrid* pChunk;
+		VDVector3i coord;
+		// Bumped whenever the slot gets or loses a chunk so chunk handles can be validated
+		VDuint generation;
 
 		VDChunkOccupation()
 		{
 			occupied = false;
 			pChunk = nullptr;
-		}
-
-		VDChunkOccupation& operator=(const VDChunkOccupation& other)
-		{
-			if (this != &other)
-			{
-				occupied = other.occupied;
-				pChunk = other.pChunk;
-			}
-
-			return *this;
+			coord = VDVector3i();
+			generation = 0;
 		}
 	};
 
-	VDChunkOccupation* grids;
+	std::vector<VDChunkOccupation> grids;
+	VDHashMap<VDVector3i, VDuint> chunkSlots;
+	std::vector<VDuint> freeSlots;
 	VDuint gridSize;
+	// log2 of gridSize, VD_NO_GRID_SHIFT when it is not a power of two
+	VDuint gridShift;
 	VDVector3i anchor;
-	VDuint horizontalGrids;
-	VDuint verticalGrids;
+	// Advanced once per simulation step, chunks remember the step they were last handed out in
+	uint64_t step;
+	VDuint compressCursor;
+	// Chunk coordinates every chunk added so far lies in, only ever grows. Bounds ray traversal.
+	VDVector3i chunkMin;
+	VDVector3i chunkMax;
+	// Changes to the chunks of the space, shared by copies of it like the chunks themselves
+	std::shared_ptr<VDChangeJournal> journal;
 
 	VDSpace()
 	{
-		grids = nullptr;
 		gridSize = 0;
+		gridShift = VD_NO_GRID_SHIFT;
 		anchor = VDVector3i();
-		horizontalGrids = 0;
-		verticalGrids = 0;
+		step = 0;
+		compressCursor = 0;
+		chunkMin = VDVector3i(INT_MAX, INT_MAX, INT_MAX);
+		chunkMax = VDVector3i(INT_MIN, INT_MIN, INT_MIN);
+		journal = std::make_shared<VDChangeJournal>(anchor, gridSize);
 	}
-	VDSpace(VDuint _chunkSize, VDVector3i _anchor, VDuint _horizontalChunks, VDuint _verticalChunks)
+
+	VDSpace(VDuint _chunkSize, VDVector3i _anchor) : VDSpace()
 	{
 		gridSize = _chunkSize;
+		gridShift = VDGridShift(gridSize);
 		anchor = _anchor;
-		horizontalGrids = _horizontalChunks;
-		verticalGrids = _verticalChunks;
-		grids = new VDChunkOccupation[horizontalGrids * horizontalGrids * verticalGrids];
-		for (VDuint z = 0; z < horizontalGrids; z++)
-		{
-			for (VDuint y = 0; y < verticalGrids; y++)
-			{
-				for (VDuint x = 0; x < horizontalGrids; x++)
-				{
-					VDuint index = x + y * horizontalGrids + z * horizontalGrids * verticalGrids;
-					grids[index] = VDChunkOccupation();
-				}
-			}
-		}
+		journal->anchor = anchor;
+		journal->gridSize = gridSize;
+	}
+
+	// The chunk counts are only a hint for how many chunks to reserve room for
+	VDSpace(VDuint _chunkSize, VDVector3i _anchor, VDuint _horizontalChunks, VDuint _verticalChunks) :
+		VDSpace(_chunkSize, _anchor)
+	{
+		reserve(_horizontalChunks * _horizontalChunks * _verticalChunks);
+	}
+
+	void reserve(VDuint chunkCount)
+	{
+		grids.reserve(chunkCount);
+		chunkSlots.reserve(chunkCount);
+	}
+
+	VDuint chunkCount() const
+	{
+		return chunkSlots.count;
+	}
+
+	// Floor division so that positions below the anchor land in negative chunk coordinates
+	VDVector3i getChunkCoord(VDVector3 worldPosition) const
+	{
+		VDVector3 local = worldPosition - anchor;
+		return getCellChunkCoord(VDVector3i((int)floorf(local.x), (int)floorf(local.y), (int)floorf(local.z)));
+	}
+
+	// Chunk coordinates of the voxel at cell, counted in voxels from the anchor
+	VDVector3i getCellChunkCoord(VDVector3i cell) const
+	{
+		// Arithmetic shifts already round toward negative infinity
+		if (gridShift != VD_NO_GRID_SHIFT)
+			return VDVector3i(cell.x >> (int)gridShift, cell.y >> (int)gridShift, cell.z >> (int)gridShift);
+		int size = (int)gridSize;
+		return VDVector3i(cell.x >= 0 ? cell.x / size : -((size - 1 - cell.x) / size),
+			cell.y >= 0 ? cell.y / size : -((size - 1 - cell.y) / size),
+			cell.z >= 0 ? cell.z / size : -((size - 1 - cell.z) / size));
 	}
 
 	bool validateChunkCoord(VDVector3i chunkCoord) const
 	{
-		if (chunkCoord.x >= 0 && chunkCoord.x < horizontalGrids)
-		{
-			if (chunkCoord.y >= 0 && chunkCoord.y < verticalGrids)
-			{
-				if (chunkCoord.z >= 0 && chunkCoord.z < horizontalGrids)
-				{
-					return true;
-				}
-			}
-		}
-		return false;
+		return chunkSlots.contains(chunkCoord);
 	}
 
+	// Slot of the chunk at chunkCoord, VD_INVALID_HANDLE_INDEX when there is none
 	VDuint getIndex(VDVector3i chunkCoord) const 
 	{
-		return chunkCoord.x + chunkCoord.y * horizontalGrids + chunkCoord.z * horizontalGrids * verticalGrids;
+		const VDuint* pSlot = chunkSlots.find(chunkCoord);
+		return pSlot != nullptr ? *pSlot : VD_INVALID_HANDLE_INDEX;
 	}
 
 	VDVector3i getChunkLow(VDVector3i chunkCoord) const
@@ -473,45 +1361,172 @@ struct VDSpace
 		return anchor + chunkCoord * gridSize;
 	}
 
-	void setChunkOccupied(VDVector3i chunkCoord)
+	// Expands a compressed chunk and marks it used in this step so it is not compressed again soon.
+	// Const queries read chunks as they are stored and never change them, so several may run at
+	// once on an unchanging space. Chunks they read often are touched beforehand on the owning thread.
+	VDGrid* touchChunk(VDGrid* pChunk)
+	{
+		pChunk->lastAccess = step;
+		pChunk->decompress();
+		return pChunk;
+	}
+
+	// touchChunk for every chunk overlapping aabb
+	void touchRegion(VDAABB aabb)
+	{
+		VDList<VDGrid*> sampled(&VDFrameArena::local());
+		sampleChunks(aabb, sampled);
+		for (auto it = sampled.pFirst; it != nullptr; it = it->pNext)
+			touchChunk(it->item);
+		sampled.free();
+	}
+
+	// Chunk as stored, compressed ones included
+	VDGrid* getChunk(VDVector3i chunkCoord) const
+	{
+		VDuint index = getIndex(chunkCoord);
+		return index != VD_INVALID_HANDLE_INDEX ? grids[index].pChunk : nullptr;
+	}
+
+	// Touched chunk, ready to be changed
+	VDGrid* getChunk(VDVector3i chunkCoord)
+	{
+		VDuint index = getIndex(chunkCoord);
+		return index != VD_INVALID_HANDLE_INDEX ? touchChunk(grids[index].pChunk) : nullptr;
+	}
+
+	// Places pChunk at chunkCoord and takes ownership of it, returns null when the
+	// coordinate already holds a chunk in which case the caller keeps pChunk
+	VDGrid* adoptChunk(VDVector3i chunkCoord, VDGrid* pChunk)
 	{
 		if (validateChunkCoord(chunkCoord))
+			return nullptr;
+		VDuint index;
+		if (!freeSlots.empty())
 		{
-			VDuint index = getIndex(chunkCoord);
-			if (!grids[index].occupied)
-			{
-				grids[index].occupied = true;
-				grids[index].pChunk = new VDGrid(gridSize, getChunkLow(chunkCoord), index);
-			}
+			index = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else
+		{
+			index = grids.size();
+			grids.push_back(VDChunkOccupation());
 		}
+		VDChunkOccupation& slot = grids[index];
+		pChunk->chunkIndex = index;
+		pChunk->low = getChunkLow(chunkCoord);
+		pChunk->lastAccess = step;
+		pChunk->pJournal = journal.get();
+		journal->append(pChunk->low, VD_CHANGE_CHUNK_ADDED);
+		pChunk->version = std::max(pChunk->version, journal->version);
+		slot.occupied = true;
+		slot.pChunk = pChunk;
+		slot.coord = chunkCoord;
+		slot.generation++;
+		chunkSlots.insert(chunkCoord, index);
+		chunkMin = VDMin(chunkMin, chunkCoord);
+		chunkMax = VDMax(chunkMax, chunkCoord);
+		return pChunk;
+	}
+
+	VDGrid* setChunkOccupied(VDVector3i chunkCoord)
+	{
+		VDuint index = getIndex(chunkCoord);
+		if (index != VD_INVALID_HANDLE_INDEX)
+			return touchChunk(grids[index].pChunk);
+		return adoptChunk(chunkCoord, new VDGrid(gridSize, getChunkLow(chunkCoord), VD_INVALID_HANDLE_INDEX, VD_CHUNK_EMPTY));
+	}
+
+	// Makes the chunk at chunkCoord empty or solid throughout without per-voxel storage.
+	// Registered colliders are kept, the chunk's voxels are replaced.
+	VDGrid* setChunkUniform(VDVector3i chunkCoord, bool solid, uint8_t material = 0)
+	{
+		VDGrid* pChunk = setChunkOccupied(chunkCoord);
+		pChunk->setUniform(solid, material);
+		pChunk->recordRegion(VDVector3i(0, 0, 0), VDVector3i(gridSize - 1, gridSize - 1, gridSize - 1));
+		return pChunk;
 	}
 
 	void insertChunk(VDVector3i chunkCoord, VDGrid chunk)
 	{
-		if (validateChunkCoord(chunkCoord))
+		VDGrid* pChunk = setChunkOccupied(chunkCoord);
+		VDuint index = pChunk->chunkIndex;
+		pChunk->release();
+		*pChunk = chunk;
+		pChunk->chunkIndex = index;
+		pChunk->low = getChunkLow(chunkCoord);
+		pChunk->pJournal = journal.get();
+		pChunk->recordRegion(VDVector3i(0, 0, 0), VDVector3i(gridSize - 1, gridSize - 1, gridSize - 1));
+	}
+
+	// Takes the chunk at chunkCoord out of the space without releasing it, the caller owns it afterwards.
+	// The chunk may still be compressed or uniform.
+	VDGrid* detachChunk(VDVector3i chunkCoord)
+	{
+		VDuint index = getIndex(chunkCoord);
+		if (index == VD_INVALID_HANDLE_INDEX)
+			return nullptr;
+		VDChunkOccupation& slot = grids[index];
+		VDGrid* pChunk = slot.pChunk;
+		journal->append(pChunk->low, VD_CHANGE_CHUNK_REMOVED);
+		pChunk->pJournal = nullptr;
+		slot.pChunk = nullptr;
+		slot.occupied = false;
+		// Colliders still registered here see a stale handle and drop their voxel lists
+		slot.generation++;
+		chunkSlots.remove(chunkCoord);
+		freeSlots.push_back(index);
+		return pChunk;
+	}
+
+	void removeChunk(VDVector3i chunkCoord)
+	{
+		VDGrid* pChunk = detachChunk(chunkCoord);
+		if (pChunk != nullptr)
 		{
-			VDuint index = getIndex(chunkCoord);
-			if (!grids[index].occupied)
-			{
-				grids[index].occupied = true;
-				grids[index].pChunk = new VDGrid(gridSize, getChunkLow(chunkCoord), index);
-			}
-			*grids[index].pChunk = chunk;
+			pChunk->release();
+			delete pChunk;
+		}
+	}
+
+	VDHandle getChunkHandle(VDVector3i chunkCoord) const
+	{
+		VDuint index = getIndex(chunkCoord);
+		if (index != VD_INVALID_HANDLE_INDEX)
+			return VDHandle(index, grids[index].generation);
+		return VDHandle();
+	}
+
+	VDGrid* getChunk(VDHandle handle) const
+	{
+		if (handle.index < grids.size() && grids[handle.index].occupied
+			&& grids[handle.index].generation == handle.generation)
+			return grids[handle.index].pChunk;
+		return nullptr;
+	}
+
+	VDGrid* getChunk(VDHandle handle)
+	{
+		VDGrid* pChunk = static_cast<const VDSpace*>(this)->getChunk(handle);
+		return pChunk != nullptr ? touchChunk(pChunk) : nullptr;
+	}
+
+	// Hands out chunks as stored, compressed ones included
+	template <typename F>
+	void forEachChunk(F function) const
+	{
+		for (const VDChunkOccupation& slot : grids)
+		{
+			if (slot.occupied)
+				function(slot.coord, slot.pChunk);
 		}
 	}
 
 	VDList<VDChunkOccupation*> sampleChunkOccupations(VDAABB aabb)
 	{
 		VDList<VDChunkOccupation*> chunkOccupations;
-		VDVector3 low = aabb.low - anchor;
-		if (low.x > gridSize*horizontalGrids || low.y > gridSize*verticalGrids || low.z > gridSize*horizontalGrids)
-			return chunkOccupations;
-		VDVector3 high = aabb.high - anchor;
-		if (high.x < 0.0f || high.y < 0.0f || high.z < 0.0f)
-			return chunkOccupations;
-
-		VDVector3i lowInd = VDVector3i(low)/gridSize;
-		VDVector3i highInd = VDVector3i(high)/gridSize;
+		VDVector3i lowInd = getChunkCoord(aabb.low);
+		VDVector3i highInd = getChunkCoord(aabb.high);
 
 		for (int x = lowInd.x; x <= highInd.x; ++x)
 		{
@@ -519,10 +1534,11 @@ struct VDSpace
 			{
 				for (int z = lowInd.z; z <= highInd.z; ++z)
 				{
-					VDVector3i chunkCoord(x, y, z);
-					if (validateChunkCoord(chunkCoord))
+					VDuint index = getIndex(VDVector3i(x, y, z));
+					if (index != VD_INVALID_HANDLE_INDEX)
 					{
-						chunkOccupations.insert(&grids[getIndex(chunkCoord)]);
+						touchChunk(grids[index].pChunk);
+						chunkOccupations.insert(&grids[index]);
 					}
 				}
 			}
@@ -533,15 +1549,31 @@ struct VDSpace
 	VDList<VDGrid*> sampleChunks(VDAABB aabb) const
 	{
 		VDList<VDGrid*> sampled;
-		VDVector3 low = aabb.low - anchor;
-		if (low.x > gridSize * horizontalGrids || low.y > gridSize * verticalGrids || low.z > gridSize * horizontalGrids)
-			return sampled;
-		VDVector3 high = aabb.high - anchor;
-		if (high.x < 0.0f || high.y < 0.0f || high.z < 0.0f)
-			return sampled;
+		sampleChunks(aabb, sampled);
+		return sampled;
+	}
+
+	// Chunks overlapping aabb as stored, see touchRegion
+	void sampleChunks(VDAABB aabb, VDList<VDGrid*>& sampled) const
+	{
+		if (chunkSlots.count == 0)
+			return;
+		VDVector3i lowInd = getChunkCoord(aabb.low);
+		VDVector3i highInd = getChunkCoord(aabb.high);
+		uint64_t span = (uint64_t)(highInd.x - lowInd.x + 1) * (uint64_t)(highInd.y - lowInd.y + 1)
+			* (uint64_t)(highInd.z - lowInd.z + 1);
 
-		VDVector3i lowInd = VDVector3i(low) / gridSize;
-		VDVector3i highInd = VDVector3i(high) / gridSize;
+		// A region spanning more coordinates than there are chunks is cheaper to answer from the chunks
+		if (span > chunkSlots.count)
+		{
+			forEachChunk([&](VDVector3i coord, VDGrid* pChunk)
+				{
+					if (coord.x >= lowInd.x && coord.x <= highInd.x && coord.y >= lowInd.y && coord.y <= highInd.y
+						&& coord.z >= lowInd.z && coord.z <= highInd.z)
+						sampled.insert(pChunk);
+				});
+			return;
+		}
 
 		for (int x = lowInd.x; x <= highInd.x; ++x)
 		{
@@ -549,24 +1581,20 @@ struct VDSpace
 			{
 				for (int z = lowInd.z; z <= highInd.z; ++z)
 				{
-					VDVector3i chunkCoord(x, y, z);
-					if (validateChunkCoord(chunkCoord))
-					{
-						VDuint index = getIndex(chunkCoord);
-						if(grids[index].occupied)
-							sampled.insert(grids[index].pChunk);
-					}
+					VDuint index = getIndex(VDVector3i(x, y, z));
+					if (index != VD_INVALID_HANDLE_INDEX)
+						sampled.insert(grids[index].pChunk);
 				}
 			}
 		}
-		return sampled;
 	}
 
-	void sampleOccupiedRegion(VDAABB aabb, VDList<VDVoxel*>& occupiedVoxels, VDList<VDPointer>& uniqueColliders, float sampleSkin = 0.0f) const
+	void sampleOccupiedRegion(VDAABB aabb, VDList<VDVoxelRef>& occupiedVoxels, VDList<VDHandle>& uniqueColliders, float sampleSkin = 0.0f) const
 	{
 		// Sample skin is required for when aabb's lie direction on top of a voxel and are not picked up by default
 		VDAABB skinnedAABB = aabb.skinnedAABB(sampleSkin);
-		VDList<VDGrid*> sampledChunks = sampleChunks(aabb);
+		VDList<VDGrid*> sampledChunks(&VDFrameArena::local());
+		sampleChunks(aabb, sampledChunks);
 		for (auto chunkIt = sampledChunks.pFirst; chunkIt != nullptr; chunkIt = chunkIt->pNext)
 		{
 			chunkIt->item->sampleOccupiedRegion(skinnedAABB, occupiedVoxels, uniqueColliders);
@@ -574,43 +1602,299 @@ struct VDSpace
 		sampledChunks.free();
 	}
 
-	void insertCollider(VDCollider& collider)
+	// Broad test for any occupied voxel in aabb, empty chunks and bricks are skipped without visiting voxels
+	bool anyOccupied(VDAABB aabb) const
+	{
+		VDList<VDGrid*> sampledChunks(&VDFrameArena::local());
+		sampleChunks(aabb, sampledChunks);
+		bool occupied = false;
+		for (auto chunkIt = sampledChunks.pFirst; chunkIt != nullptr && !occupied; chunkIt = chunkIt->pNext)
+			occupied = chunkIt->item->anyOccupied(aabb);
+		sampledChunks.free();
+		return occupied;
+	}
+
+	VDuint countOccupied(VDAABB aabb) const
+	{
+		VDList<VDGrid*> sampledChunks(&VDFrameArena::local());
+		sampleChunks(aabb, sampledChunks);
+		VDuint count = 0;
+		for (auto chunkIt = sampledChunks.pFirst; chunkIt != nullptr; chunkIt = chunkIt->pNext)
+			count += chunkIt->item->countOccupied(aabb);
+		sampledChunks.free();
+		return count;
+	}
+
+	// Amanatides-Woo traversal of the voxels along the ray from from in direction dir, which is expected
+	// to be normalized, up to maxDistance. Calls visit(pChunk, index, coords, distance, normal) for each
+	// voxel in order with the distance at which the ray enters it and the normal of the entered face,
+	// stops once visit returns false. Missing chunks, empty chunks and empty bricks are crossed in one step
+	// unless visitColliders is set and the chunk has voxel colliders. Allocates nothing.
+	// Compressed chunks are read as stored, their empty bricks are crossed through the brick summary
+	// they keep. A trace changes nothing, so several may run at once on an unchanging space.
+	template <typename F>
+	void traceRay(VDVector3 from, VDVector3 dir, float maxDistance, bool visitColliders, F visit) const
+	{
+		if (chunkSlots.count == 0 || gridSize == 0)
+			return;
+		int size = (int)gridSize;
+		float origin[3] = { from.x - anchor.x, from.y - anchor.y, from.z - anchor.z };
+		float direction[3] = { dir.x, dir.y, dir.z };
+		int boundsLow[3] = { chunkMin.x * size, chunkMin.y * size, chunkMin.z * size };
+		int boundsHigh[3] = { (chunkMax.x + 1) * size, (chunkMax.y + 1) * size, (chunkMax.z + 1) * size };
+
+		// Clip the ray to the chunks there are
+		float t = 0.0f;
+		float tEnd = maxDistance;
+		for (int a = 0; a < 3; a++)
+		{
+			if (direction[a] == 0.0f)
+			{
+				if (origin[a] < boundsLow[a] || origin[a] >= boundsHigh[a])
+					return;
+				continue;
+			}
+			float t0 = (boundsLow[a] - origin[a]) / direction[a];
+			float t1 = (boundsHigh[a] - origin[a]) / direction[a];
+			t = VDMax(t, VDMin(t0, t1));
+			tEnd = VDMin(tEnd, VDMax(t0, t1));
+		}
+		if (t > tEnd)
+			return;
+
+		int voxel[3];
+		int step[3];
+		float tMax[3];
+		float tDelta[3];
+		for (int a = 0; a < 3; a++)
+		{
+			float p = origin[a] + direction[a] * t;
+			voxel[a] = VDMin(VDMax((int)floorf(p), boundsLow[a]), boundsHigh[a] - 1);
+			if (direction[a] > 0.0f)
+			{
+				step[a] = 1;
+				tDelta[a] = 1.0f / direction[a];
+				tMax[a] = (voxel[a] + 1 - origin[a]) * tDelta[a];
+			}
+			else if (direction[a] < 0.0f)
+			{
+				step[a] = -1;
+				tDelta[a] = -1.0f / direction[a];
+				tMax[a] = (origin[a] - voxel[a]) * tDelta[a];
+			}
+			else
+			{
+				step[a] = 0;
+				tDelta[a] = FLT_MAX;
+				tMax[a] = FLT_MAX;
+			}
+		}
+		// Entering the clipped ray through a face of the bounds gives that face's normal
+		int axis = -1;
+		if (t > 0.0f)
+		{
+			for (int a = 0; a < 3; a++)
+			{
+				if (step[a] != 0 && (axis < 0 || tMax[a] - tDelta[a] > tMax[axis] - tDelta[axis]))
+					axis = a;
+			}
+		}
+
+		const VDGrid* pChunk = nullptr;
+		// Lowest voxel of the current chunk, the chunk is looked up again only once the ray leaves it
+		int chunkLow[3] = { 0, 0, 0 };
+		bool chunkKnown = false;
+		while (t <= tEnd)
+		{
+			if (!chunkKnown || voxel[0] < chunkLow[0] || voxel[1] < chunkLow[1] || voxel[2] < chunkLow[2]
+				|| voxel[0] - chunkLow[0] >= size || voxel[1] - chunkLow[1] >= size || voxel[2] - chunkLow[2] >= size)
+			{
+				VDVector3i coord = getCellChunkCoord(VDVector3i(voxel[0], voxel[1], voxel[2]));
+				VDuint slot = getIndex(coord);
+				pChunk = slot != VD_INVALID_HANDLE_INDEX ? grids[slot].pChunk : nullptr;
+				chunkLow[0] = coord.x * size;
+				chunkLow[1] = coord.y * size;
+				chunkLow[2] = coord.z * size;
+				chunkKnown = true;
+			}
+
+			// Size of the empty cell around the voxel that can be crossed at once, 0 to visit the voxel
+			int cellSize = size;
+			int cellLow[3] = { chunkLow[0], chunkLow[1], chunkLow[2] };
+			if (pChunk != nullptr)
+			{
+				bool colliders = visitColliders && pChunk->voxelColliders.count > 0;
+				int local[3] = { voxel[0] - cellLow[0], voxel[1] - cellLow[1], voxel[2] - cellLow[2] };
+				if (colliders || pChunk->uniform == VD_CHUNK_SOLID)
+				{
+					cellSize = 0;
+				}
+				else if (pChunk->uniform == VD_CHUNK_MIXED)
+				{
+					VDuint brick = pChunk->brickIndex(local[0] >> VD_BRICK_SHIFT, local[1] >> VD_BRICK_SHIFT, local[2] >> VD_BRICK_SHIFT);
+					if ((pChunk->readBricks()[brick >> 6] >> (brick & 63)) & 1)
+					{
+						cellSize = 0;
+					}
+					else
+					{
+						cellSize = VD_BRICK_SIZE;
+						for (int a = 0; a < 3; a++)
+							cellLow[a] += (local[a] >> VD_BRICK_SHIFT) << VD_BRICK_SHIFT;
+					}
+				}
+				if (cellSize == 0)
+				{
+					VDVector3 normal;
+					if (axis == 0)
+						normal.x = (float)-step[0];
+					else if (axis == 1)
+						normal.y = (float)-step[1];
+					else if (axis == 2)
+						normal.z = (float)-step[2];
+					VDuint index = pChunk->getIndex(local[0], local[1], local[2]);
+					if (!visit(const_cast<VDGrid*>(pChunk), index, VDVector3i(voxel[0], voxel[1], voxel[2]), t, normal))
+						return;
+				}
+			}
+
+			if (cellSize == 0)
+			{
+				axis = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+				t = tMax[axis];
+				voxel[axis] += step[axis];
+				tMax[axis] += tDelta[axis];
+				continue;
+			}
+
+			// Leave the empty cell: the axis whose last boundary inside the cell comes first is the exit,
+			// the other axes advance by the boundaries they cross before it
+			int crossings[3];
+			float tExit = FLT_MAX;
+			for (int a = 0; a < 3; a++)
+			{
+				int cellHigh = VDMin(cellLow[a] + cellSize, chunkLow[a] + size) - 1;
+				crossings[a] = step[a] > 0 ? cellHigh - voxel[a] + 1 : step[a] < 0 ? voxel[a] - cellLow[a] + 1 : 0;
+				if (step[a] != 0)
+				{
+					float tAxis = tMax[a] + (crossings[a] - 1) * tDelta[a];
+					if (tAxis < tExit)
+					{
+						tExit = tAxis;
+						axis = a;
+					}
+				}
+			}
+			for (int a = 0; a < 3; a++)
+			{
+				int advance = crossings[a];
+				if (a != axis)
+					advance = tMax[a] > tExit ? 0 : VDMin((int)((tExit - tMax[a]) / tDelta[a]) + 1, crossings[a] - 1);
+				voxel[a] += step[a] * advance;
+				tMax[a] += tDelta[a] * advance;
+			}
+			t = tExit;
+		}
+	}
+
+	// First occupied voxel along the ray, see traceRay
+	bool rayCast(VDVector3 from, VDVector3 dir, float maxDistance, VDRayHit& hit) const
+	{
+		bool found = false;
+		traceRay(from, dir, maxDistance, false, [&](VDGrid* pChunk, VDuint index, VDVector3i coords, float distance, VDVector3 normal)
+			{
+				if (!pChunk->getOccupied(index))
+					return true;
+				hit.voxel = pChunk->voxelRef(index);
+				hit.coords = coords;
+				hit.distance = distance;
+				hit.point = from + dir * distance;
+				hit.normal = normal;
+				hit.collider = VDHandle();
+				found = true;
+				return false;
+			});
+		return found;
+	}
+
+	// Registers handle in the voxels overlapping bounds, occupiedChunks records where so it can be removed again.
+	// Callers that keep the bounds elsewhere, like VDBodyStore, only need to store occupiedChunks.
+	void insertCollider(VDHandle handle, const VDAABB& bounds, VDList<VDColliderChunk>& occupiedChunks)
 	{
-		VDList<VDGrid*> sampled = sampleChunks(collider);
+		VDList<VDGrid*> sampled(&VDFrameArena::local());
+		sampleChunks(bounds, sampled);
 		for (auto it = sampled.pFirst; it != nullptr; it = it->pNext)
 		{
-			VDList<VDPointer>* occupiedVoxels = collider.occupiedChunks.insert(VDList<VDPointer>());
-			occupiedVoxels->id = it->item->chunkIndex;
-			it->item->insertCollider(collider, occupiedVoxels);
+			VDColliderChunk* pEntry = occupiedChunks.insert(VDColliderChunk());
+			pEntry->chunk = VDHandle(it->item->chunkIndex, grids[it->item->chunkIndex].generation);
+			it->item->insertCollider(handle, bounds, &pEntry->voxels);
 		}
 		sampled.free();
 	}
 
-	void removeCollider(VDCollider& collider)
+	void removeCollider(VDHandle handle, VDList<VDColliderChunk>& occupiedChunks)
 	{
-		for (auto it = collider.occupiedChunks.pFirst; it != nullptr; it = it->pNext)
+		for (auto it = occupiedChunks.pFirst; it != nullptr; it = it->pNext)
 		{
-			VDGrid* pChunk = grids[it->item.id].pChunk;
-			pChunk->removeCollider(collider, &it->item);
+			VDGrid* pChunk = getChunk(it->item.chunk);
+			if (pChunk != nullptr)
+				pChunk->removeCollider(handle, &it->item.voxels);
+			else
+				it->item.voxels.free();
 		}
-		collider.occupiedChunks.free();
+		occupiedChunks.free();
+	}
+
+	void updateCollider(VDHandle handle, const VDAABB& bounds, VDList<VDColliderChunk>& occupiedChunks)
+	{
+		removeCollider(handle, occupiedChunks);
+		insertCollider(handle, bounds, occupiedChunks);
+	}
+
+	void insertCollider(VDCollider& collider)
+	{
+		insertCollider(collider.handle, collider, collider.occupiedChunks);
+	}
+
+	void removeCollider(VDCollider& collider)
+	{
+		removeCollider(collider.handle, collider.occupiedChunks);
 	}
 
 	void updateCollider(VDCollider& collider)
 	{
-		removeCollider(collider);
-		insertCollider(collider);
+		updateCollider(collider.handle, collider, collider.occupiedChunks);
 	}
 
-	VDVector3i moveIndex(VDuint& index, VDVector3i& chunkCoord, VDDirection direction) const
+
+	// Compresses up to maxChunks chunks that were not handed out during the last idleSteps steps.
+	// The walk over the slots resumes where the previous call stopped and looks at a bounded
+	// number of them, so calling it every step stays cheap for large worlds.
+	VDuint compressColdChunks(uint64_t idleSteps, VDuint maxChunks)
 	{
-		VDuint chunkIndex = getIndex(chunkCoord);
-		VDuint chunkMax = horizontalGrids * horizontalGrids * verticalGrids;
-		if (chunkIndex >= chunkMax)
-			return VDVector3i(-1, -1, -1);
-		if(!grids[chunkIndex].occupied)
+		VDuint compressed = 0;
+		size_t visits = std::min(grids.size(), (size_t)maxChunks * 32);
+		for (size_t i = 0; i < visits && compressed < maxChunks; i++)
+		{
+			if (compressCursor >= grids.size())
+				compressCursor = 0;
+			VDChunkOccupation& slot = grids[compressCursor++];
+			if (slot.occupied && !slot.pChunk->isCompressed() && slot.pChunk->lastAccess + idleSteps <= step
+				&& slot.pChunk->compress())
+				compressed++;
+		}
+		return compressed;
+	}
+
+	// Coordinates of the voxel next to index in direction, in the chunk at chunkCoord. When the neighbour
+	// lies in the adjacent chunk, chunkCoord is stepped there and the coordinates wrap around.
+	// Returns (-1, -1, -1) when there is no chunk at chunkCoord.
+	VDVector3i moveIndex(VDuint index, VDVector3i& chunkCoord, VDDirection direction) const
+	{
+		VDGrid* pChunk = getChunk(chunkCoord);
+		if (pChunk == nullptr)
 			return VDVector3i(-1, -1, -1);
-		VDVector3i voxCoord = grids[chunkIndex].pChunk->getCoordinates(index);
+		VDVector3i voxCoord = pChunk->getCoordinates(index);
 		switch (direction)
 		{
 		case VDDirection::RIGHT:
@@ -632,99 +1916,49 @@ struct VDSpace
 			voxCoord.z -= 1;
 			break;
 		}
-		if (voxCoord.x < 0)
-		{
-			chunkCoord.x -= 1;
-			voxCoord.x = gridSize - 1;
-		}
-		if (voxCoord.x >= gridSize)
-		{
-			chunkCoord.x += 1;
-			voxCoord.x = 0;
-		}
-		if (voxCoord.y < 0)
-		{
-			chunkCoord.y -= 1;
-			voxCoord.y = gridSize - 1;
-		}
-		if (voxCoord.y >= gridSize)
-		{
-			chunkCoord.y += 1;
-			voxCoord.y = 0;
-		}
-		if (voxCoord.z < 0)
-		{
-			chunkCoord.z -= 1;
-			voxCoord.z = gridSize - 1;
-		}
-		if (voxCoord.z >= gridSize)
+		if (pChunk->validateCoords(voxCoord))
+			return voxCoord;
+		// Only the moved axis is out of range, by one voxel on either side
+		int size = (int)gridSize;
+		chunkCoord.x += voxCoord.x < 0 ? -1 : voxCoord.x >= size ? 1 : 0;
+		chunkCoord.y += voxCoord.y < 0 ? -1 : voxCoord.y >= size ? 1 : 0;
+		chunkCoord.z += voxCoord.z < 0 ? -1 : voxCoord.z >= size ? 1 : 0;
+		if (gridShift != VD_NO_GRID_SHIFT)
 		{
-			chunkCoord.z += 1;
-			voxCoord.z = 0;
+			int mask = size - 1;
+			return VDVector3i(voxCoord.x & mask, voxCoord.y & mask, voxCoord.z & mask);
 		}
-		return voxCoord;
+		return VDVector3i((voxCoord.x + size) % size, (voxCoord.y + size) % size, (voxCoord.z + size) % size);
 	}
 
 	VDVector3i getCoordinates(VDuint index) const
 	{
-		VDVector3i coords;
-		coords.z = index / (horizontalGrids * verticalGrids);
-		coords.y = (index % (horizontalGrids * verticalGrids)) / horizontalGrids;
-		coords.x = index % horizontalGrids;
-		return coords;
+		return grids[index].coord;
 	}
 
-	bool getValidGridCoords(VDVector3 worldPosition, VDVector3i& gridCoord)
+	// Writes the chunk coordinates containing worldPosition and returns whether a chunk exists there
+	bool getValidGridCoords(VDVector3 worldPosition, VDVector3i& gridCoord) const
 	{
-		VDVector3 local = worldPosition - anchor;
-		if (local.x >= 0.0f && local.y >= 0.0f && local.z >= 0.0f)
-		{
-			VDVector3i _gridCoord = VDVector3i(local) / gridSize;
-			if (validateChunkCoord(_gridCoord))
-			{
-				gridCoord = _gridCoord;
-				return true;
-			}
-		}
-		return false;
+		gridCoord = getChunkCoord(worldPosition);
+		return validateChunkCoord(gridCoord);
 	}
 
 	void setVoxelOccupied(VDVector3 worldPosition)
 	{
-		VDVector3i gridCoord;
-		if (getValidGridCoords(worldPosition, gridCoord))
-		{
-			VDuint index = getIndex(gridCoord);
-			if (!grids[index].occupied)
-				setChunkOccupied(gridCoord);
-			grids[index].pChunk->setOccupied(worldPosition);
-		}
+		setChunkOccupied(getChunkCoord(worldPosition))->setOccupied(worldPosition);
 	}
 
-	VDVoxel* getVoxel(VDVector3 worldPosition)
+	VDVoxelRef getVoxel(VDVector3 worldPosition)
 	{
-		VDVector3i gridCoord;
-		if (getValidGridCoords(worldPosition, gridCoord))
-		{
-			VDuint index = getIndex(gridCoord);
-			if (grids[index].occupied)
-			{
-				return grids[index].pChunk->getVoxel(worldPosition);
-			}
-		}
-		return nullptr;
+		VDGrid* pChunk = getGrid(worldPosition);
+		if (pChunk != nullptr)
+			return pChunk->getVoxel(worldPosition);
+		return VDVoxelRef();
 	}
 
-	VDGrid* getGrid(VDVector3 position)
+	VDGrid* getGrid(VDVector3 position) const
 	{
-		VDVector3i gridCoord;
-		if (getValidGridCoords(position, gridCoord))
-		{
-			VDuint index = getIndex(gridCoord);
-			if (grids[index].occupied)
-				return grids[index].pChunk;
-		}
-		return nullptr;
+		return getChunk(getChunkCoord(position));
 	}
 };
 
@@ -0,0 +1,328 @@
+#ifndef VOXEL_DYNAMICS_STREAMING
+#define VOXEL_DYNAMICS_STREAMING
+
+#include "VoxelDynamicsSpace.h"
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+// Fills a freshly allocated chunk, returns false when the chunk is empty and should not be kept.
+// Runs on a streaming worker, so it must be thread safe. The worker resets its frame arena after every job.
+typedef std::function<bool(VDVector3i chunkCoord, VDGrid& chunk)> VDChunkLoader;
+// Persists an evicted chunk right before it is released, also runs on a streaming worker.
+// The chunk is handed over with its per-voxel storage, uniform chunks are materialized first.
+typedef std::function<void(VDVector3i chunkCoord, const VDGrid& chunk)> VDChunkSaver;
+
+struct VDStreamingSettings
+{
+	// Chunks within this many chunks of a focus on each axis are kept resident
+	VDuint horizontalRadius;
+	VDuint verticalRadius;
+	// Streamed chunks kept in memory, out of range chunks past it are evicted least recently used first
+	VDuint maxResidentChunks;
+	// Coordinates the loader reported empty, remembered so they are not loaded again right away
+	VDuint maxEmptyChunks;
+	// Loaded chunks handed to the space per step, bounds the work done at the safe point
+	VDuint maxChunksPerUpdate;
+	VDuint workerCount;
+	// Awake bodies keep the chunks around them resident as well as the registered agents
+	bool followBodies;
+
+	VDStreamingSettings()
+	{
+		horizontalRadius = 2;
+		verticalRadius = 1;
+		maxResidentChunks = 256;
+		maxEmptyChunks = 4096;
+		maxChunksPerUpdate = 4;
+		workerCount = 1;
+		followBodies = true;
+	}
+};
+
+#define VD_STREAM_LOADING 0
+#define VD_STREAM_RESIDENT 1
+#define VD_STREAM_EMPTY 2
+#define VD_STREAM_SAVING 3
+
+struct VDStreamedChunk
+{
+	uint8_t state;
+	uint64_t lastUsed;
+};
+
+struct VDStreamJob
+{
+	VDVector3i coord;
+	// Detached chunk for saves, the loaded chunk or null when empty for finished loads
+	VDGrid* pChunk;
+	bool save;
+};
+
+// Keeps the chunks around a set of focus points resident in a VDSpace. Loads and saves run
+// on worker threads, everything touching the space happens in update() on the simulation thread.
+// Only chunks the streamer loaded itself are ever evicted.
+struct VDChunkStreamer
+{
+	VDStreamingSettings settings;
+	VDChunkLoader loader;
+	VDChunkSaver saver;
+	VDuint gridSize;
+	VDVector3i anchor;
+	// Agents registered as focus points, stale handles are dropped on update
+	std::vector<VDHandle> agents;
+
+	VDHashMap<VDVector3i, VDStreamedChunk> chunks;
+	VDHashMap<VDVector3i, bool> focusChunks;
+	std::vector<VDStreamJob> ready;
+	std::vector<std::pair<uint64_t, VDVector3i>> evictable;
+	uint64_t updateCount;
+	VDuint residentCount;
+	VDuint emptyCount;
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<VDStreamJob> jobs;
+	std::vector<VDStreamJob> finished;
+	bool stopping;
+
+	VDChunkStreamer(const VDStreamingSettings& _settings, VDChunkLoader _loader, VDChunkSaver _saver, VDuint _gridSize, VDVector3i _anchor)
+	{
+		settings = _settings;
+		loader = _loader;
+		saver = _saver;
+		gridSize = _gridSize;
+		anchor = _anchor;
+		updateCount = 0;
+		residentCount = 0;
+		emptyCount = 0;
+		stopping = false;
+		VDuint workerCount = settings.workerCount > 0 ? settings.workerCount : 1;
+		for (VDuint i = 0; i < workerCount; i++)
+			workers.push_back(std::thread(&VDChunkStreamer::workerLoop, this));
+	}
+
+	VDChunkStreamer(const VDChunkStreamer&) = delete;
+	VDChunkStreamer& operator=(const VDChunkStreamer&) = delete;
+
+	// Pending saves are still written, pending loads are dropped
+	~VDChunkStreamer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+		for (size_t i = 0; i < finished.size(); i++)
+			ready.push_back(finished[i]);
+		for (size_t i = 0; i < ready.size(); i++)
+		{
+			if (ready[i].pChunk != nullptr)
+			{
+				ready[i].pChunk->release();
+				delete ready[i].pChunk;
+			}
+		}
+	}
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			VDStreamJob job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = jobs.front();
+				jobs.pop_front();
+				if (stopping && !job.save)
+					continue;
+			}
+			if (job.save)
+			{
+				if (saver)
+				{
+					job.pChunk->materialize();
+					saver(job.coord, *job.pChunk);
+				}
+				job.pChunk->release();
+				delete job.pChunk;
+				job.pChunk = nullptr;
+			}
+			else
+			{
+				VDGrid* pChunk = new VDGrid(gridSize, anchor + job.coord * gridSize, VD_INVALID_HANDLE_INDEX);
+				if (!loader || !loader(job.coord, *pChunk))
+				{
+					pChunk->release();
+					delete pChunk;
+					pChunk = nullptr;
+				}
+				else
+				{
+					// Loaders may fill occupancy directly
+					pChunk->rebuildBricks();
+					pChunk->makeUniform();
+				}
+				job.pChunk = pChunk;
+			}
+			VDFrameArena::local().reset();
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.push_back(job);
+		}
+	}
+
+	void enqueue(VDVector3i coord, VDGrid* pChunk, bool save)
+	{
+		VDStreamJob job;
+		job.coord = coord;
+		job.pChunk = pChunk;
+		job.save = save;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(job);
+		}
+		wake.notify_one();
+	}
+
+	// Marks the chunk at chunkCoord as the center of a resident region for the next update
+	void addFocus(VDVector3i chunkCoord)
+	{
+		focusChunks.insert(chunkCoord, true);
+	}
+
+	void addAgent(VDHandle agent)
+	{
+		agents.push_back(agent);
+	}
+
+	void removeAgent(VDHandle agent)
+	{
+		agents.erase(std::remove(agents.begin(), agents.end(), agent), agents.end());
+	}
+
+	// Safe point: hands finished loads to the space, requests missing chunks around the focus
+	// points added since the last update and evicts out of range chunks over the budget.
+	// Chunks that entered the space are appended to adopted.
+	void update(VDSpace& space, VDList<VDGrid*>& adopted)
+	{
+		updateCount++;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ready.insert(ready.end(), finished.begin(), finished.end());
+			finished.clear();
+		}
+
+		VDuint adoptedCount = 0;
+		size_t kept = 0;
+		for (size_t i = 0; i < ready.size(); i++)
+		{
+			VDStreamJob& job = ready[i];
+			VDStreamedChunk* pEntry = chunks.find(job.coord);
+			if (job.save)
+			{
+				chunks.remove(job.coord);
+			}
+			else if (job.pChunk == nullptr)
+			{
+				pEntry->state = VD_STREAM_EMPTY;
+				emptyCount++;
+			}
+			else if (adoptedCount >= settings.maxChunksPerUpdate)
+			{
+				ready[kept++] = job;
+			}
+			else if (space.adoptChunk(job.coord, job.pChunk) != nullptr)
+			{
+				// Counts as used so it survives this update's eviction pass
+				pEntry->state = VD_STREAM_RESIDENT;
+				pEntry->lastUsed = updateCount;
+				residentCount++;
+				adoptedCount++;
+				adopted.insert(job.pChunk);
+			}
+			else
+			{
+				// The chunk was created by hand while loading, that one wins
+				job.pChunk->release();
+				delete job.pChunk;
+				chunks.remove(job.coord);
+			}
+		}
+		ready.resize(kept);
+
+		focusChunks.forEach([&](const VDVector3i& focus, bool&)
+			{
+				int h = (int)settings.horizontalRadius;
+				int v = (int)settings.verticalRadius;
+				for (int z = focus.z - h; z <= focus.z + h; z++)
+				{
+					for (int y = focus.y - v; y <= focus.y + v; y++)
+					{
+						for (int x = focus.x - h; x <= focus.x + h; x++)
+						{
+							VDVector3i coord(x, y, z);
+							VDStreamedChunk* pEntry = chunks.find(coord);
+							if (pEntry != nullptr)
+							{
+								pEntry->lastUsed = updateCount;
+							}
+							else if (!space.validateChunkCoord(coord))
+							{
+								VDStreamedChunk entry;
+								entry.state = VD_STREAM_LOADING;
+								entry.lastUsed = updateCount;
+								chunks.insert(coord, entry);
+								enqueue(coord, nullptr, false);
+							}
+						}
+					}
+				}
+			});
+		focusChunks.clear();
+
+		evictable.clear();
+		chunks.forEach([&](const VDVector3i& coord, VDStreamedChunk& entry)
+			{
+				if (entry.lastUsed != updateCount && (entry.state == VD_STREAM_RESIDENT || entry.state == VD_STREAM_EMPTY))
+					evictable.push_back(std::make_pair(entry.lastUsed, coord));
+			});
+		std::sort(evictable.begin(), evictable.end(),
+			[](const std::pair<uint64_t, VDVector3i>& a, const std::pair<uint64_t, VDVector3i>& b) { return a.first < b.first; });
+		for (size_t i = 0; i < evictable.size(); i++)
+		{
+			VDVector3i coord = evictable[i].second;
+			VDStreamedChunk* pEntry = chunks.find(coord);
+			if (pEntry->state == VD_STREAM_EMPTY)
+			{
+				if (emptyCount > settings.maxEmptyChunks)
+				{
+					chunks.remove(coord);
+					emptyCount--;
+				}
+			}
+			else if (residentCount > settings.maxResidentChunks)
+			{
+				VDGrid* pChunk = space.detachChunk(coord);
+				residentCount--;
+				if (pChunk != nullptr)
+				{
+					pEntry->state = VD_STREAM_SAVING;
+					enqueue(coord, pChunk, true);
+				}
+				else
+				{
+					chunks.remove(coord);
+				}
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef VOXEL_DYNAMICS_TERRAIN
+#define VOXEL_DYNAMICS_TERRAIN
+
+#include "VoxelDynamicsStreaming.h"
+#include "VoxelDynamicsWorkers.h"
+
+// Bits of the values above threshold, values[i] gives bit i. count is at most 64.
+uint64_t VDThresholdBits(const float* values, VDuint count, float threshold)
+{
+	uint64_t bits = 0;
+	VDuint i = 0;
+#ifdef VD_SSE
+	__m128 limit = _mm_set1_ps(threshold);
+	for (; i + 4 <= count; i += 4)
+		bits |= (uint64_t)_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(values + i), limit)) << i;
+#endif
+	for (; i < count; i++)
+		bits |= (uint64_t)(values[i] > threshold) << i;
+	return bits;
+}
+
+// Replaces the occupancy of row (y, z) of a dense chunk, voxel x is occupied when values[x] is above
+// threshold. Meant for generators, the brick summary is left to rebuildBricks.
+void VDFillRow(VDGrid& chunk, VDuint y, VDuint z, const float* values, float threshold)
+{
+	uint64_t* pRow = chunk.occupancy + chunk.rowWord(y, z);
+	for (VDuint word = 0; word < chunk.rowWords; word++)
+		pRow[word] = VDThresholdBits(values + word * 64, VDMin(chunk.gridSize - word * 64, 64u), threshold);
+}
+
+// Fills a dense chunk from the world heights of its gridSize * gridSize columns, indexed
+// x + z * gridSize. A voxel is occupied when its center lies below its column's height.
+// Returns false when no voxel is.
+bool VDFillHeightmap(VDGrid& chunk, const float* heights)
+{
+	VDuint size = chunk.gridSize;
+	float lowest = FLT_MAX;
+	float highest = -FLT_MAX;
+	for (VDuint i = 0; i < size * size; i++)
+	{
+		lowest = VDMin(lowest, heights[i]);
+		highest = VDMax(highest, heights[i]);
+	}
+	bool any = false;
+	for (VDuint z = 0; z < size; z++)
+	{
+		for (VDuint y = 0; y < size; y++)
+		{
+			float center = chunk.low.y + y + 0.5f;
+			uint64_t* pRow = chunk.occupancy + chunk.rowWord(y, z);
+			// Rows clear of the whole surface are written without comparing heights
+			if (center >= highest || center < lowest)
+			{
+				for (VDuint word = 0; word < chunk.rowWords; word++)
+					pRow[word] = center < lowest ? chunk.fullWord(word) : 0;
+			}
+			else
+			{
+				VDFillRow(chunk, y, z, heights + z * size, center);
+			}
+			any = any || center < highest;
+		}
+	}
+	return any;
+}
+
+// Generates the chunks from lowChunk to highChunk the space does not hold yet. generator fills each
+// freshly allocated dense chunk as a VDChunkLoader would and may write occupancy rows directly.
+// Chunks are generated on the threads of pPool when given and added to the space on the calling
+// thread afterwards, empty and solid ones without per-voxel storage. Returns the number added.
+VDuint VDGenerateChunks(VDSpace& space, VDVector3i lowChunk, VDVector3i highChunk, const VDChunkLoader& generator, VDWorkerPool* pPool = nullptr)
+{
+	std::vector<VDVector3i> coords;
+	for (int z = lowChunk.z; z <= highChunk.z; z++)
+	{
+		for (int y = lowChunk.y; y <= highChunk.y; y++)
+		{
+			for (int x = lowChunk.x; x <= highChunk.x; x++)
+			{
+				if (!space.validateChunkCoord(VDVector3i(x, y, z)))
+					coords.push_back(VDVector3i(x, y, z));
+			}
+		}
+	}
+	std::vector<VDGrid*> generated(coords.size(), nullptr);
+	auto generateRange = [&](VDuint begin, VDuint end)
+		{
+			for (VDuint i = begin; i < end; i++)
+			{
+				VDGrid* pChunk = new VDGrid(space.gridSize, space.getChunkLow(coords[i]), VD_INVALID_HANDLE_INDEX);
+				if (!generator(coords[i], *pChunk))
+				{
+					pChunk->release();
+					delete pChunk;
+					continue;
+				}
+				pChunk->rebuildBricks();
+				pChunk->makeUniform();
+				generated[i] = pChunk;
+			}
+		};
+	if (pPool != nullptr)
+		pPool->parallelFor((VDuint)coords.size(), 1, generateRange);
+	else
+		generateRange(0, (VDuint)coords.size());
+
+	VDuint added = 0;
+	for (size_t i = 0; i < coords.size(); i++)
+	{
+		if (generated[i] != nullptr && space.adoptChunk(coords[i], generated[i]) != nullptr)
+			added++;
+	}
+	return added;
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef VOXEL_DYNAMICS_WORKERS
+#define VOXEL_DYNAMICS_WORKERS
+
+#include "VoxelDynamicsAllocator.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+// Persistent threads splitting index ranges of one job at a time with the calling thread.
+// Jobs may build lists in the frame arena of the thread they run on, workers reset their own
+// arena after every job and the calling thread's arena is left to its owner.
+struct VDWorkerPool
+{
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::function<void(VDuint begin, VDuint end)> job;
+	VDuint jobCount;
+	VDuint jobGrain;
+	std::atomic<VDuint> nextIndex;
+	// Workers that have not finished the current job yet
+	VDuint busy;
+	uint64_t generation;
+	bool stopping;
+
+	// Starts threadCount - 1 workers, the caller of parallelFor is the last thread
+	VDWorkerPool(VDuint threadCount)
+	{
+		jobCount = 0;
+		jobGrain = 1;
+		nextIndex = 0;
+		busy = 0;
+		generation = 0;
+		stopping = false;
+		for (VDuint i = 1; i < threadCount; i++)
+			workers.push_back(std::thread(&VDWorkerPool::workerLoop, this));
+	}
+
+	VDWorkerPool(const VDWorkerPool&) = delete;
+	VDWorkerPool& operator=(const VDWorkerPool&) = delete;
+
+	~VDWorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	VDuint threadCount() const
+	{
+		return (VDuint)workers.size() + 1;
+	}
+
+	void runRanges()
+	{
+		for (;;)
+		{
+			VDuint begin = nextIndex.fetch_add(jobGrain);
+			if (begin >= jobCount)
+				return;
+			job(begin, VDMin(begin + jobGrain, jobCount));
+		}
+	}
+
+	void workerLoop()
+	{
+		uint64_t seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+			}
+			runRanges();
+			VDFrameArena::local().reset();
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busy == 0)
+				done.notify_one();
+		}
+	}
+
+	// Calls function(begin, end) for ranges of grain indices covering [0, count) and returns
+	// once all of them ran. Only one thread may issue jobs at a time.
+	void parallelFor(VDuint count, VDuint grain, const std::function<void(VDuint begin, VDuint end)>& function)
+	{
+		if (count == 0)
+			return;
+		grain = VDMax(grain, 1u);
+		if (workers.empty() || count <= grain)
+		{
+			function(0, count);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = function;
+			jobCount = count;
+			jobGrain = grain;
+			nextIndex = 0;
+			busy = (VDuint)workers.size();
+			generation++;
+		}
+		wake.notify_all();
+		runRanges();
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [&] { return busy == 0; });
+		job = nullptr;
+	}
+};
+
+#endif
@@ -0,0 +1,401 @@
+#ifndef VOXEL_DYNAMICS_WORLD_FILE
+#define VOXEL_DYNAMICS_WORLD_FILE
+
+#include "VoxelDynamicsSpace.h"
+#include <cstdio>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// World file layout, all little endian:
+//   VDWorldFileHeader
+//   per chunk, 8 byte aligned: occupancy words exactly as VDGrid keeps them, then
+//   indexCount material bytes when VD_WORLD_CHUNK_HAS_MATERIALS is set. Chunks with
+//   VD_WORLD_CHUNK_UNIFORM set have no payload, their entry holds the state and material.
+//   chunkCount VDWorldChunkEntry records at directoryOffset
+// Chunks are copied out of the mapping in bulk, only the directory is read on open.
+#define VD_WORLD_FILE_MAGIC 0x46574456u
+#define VD_WORLD_FILE_VERSION 2
+#define VD_WORLD_CHUNK_HAS_MATERIALS 0x1
+#define VD_WORLD_CHUNK_UNIFORM 0x2
+
+struct VDWorldFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t gridSize;
+	uint32_t chunkCount;
+	int32_t anchor[3];
+	uint32_t reserved;
+	uint64_t directoryOffset;
+};
+
+struct VDWorldChunkEntry
+{
+	int32_t coord[3];
+	uint16_t flags;
+	// VD_CHUNK_EMPTY or VD_CHUNK_SOLID and the material of every voxel of a uniform chunk
+	uint8_t uniform;
+	uint8_t material;
+	uint64_t offset;
+};
+
+static_assert(sizeof(VDVoxel) == 1, "World files store one material byte per voxel");
+static_assert(sizeof(VDWorldFileHeader) == 40 && sizeof(VDWorldChunkEntry) == 24, "World file records must stay packed");
+
+// Read only view of a whole file
+struct VDMappedFile
+{
+	const uint8_t* data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+
+	VDMappedFile()
+	{
+		data = nullptr;
+		size = 0;
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#else
+		fd = -1;
+#endif
+	}
+
+	VDMappedFile(const VDMappedFile&) = delete;
+	VDMappedFile& operator=(const VDMappedFile&) = delete;
+
+	~VDMappedFile()
+	{
+		close();
+	}
+
+	bool open(const char* path)
+	{
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+		size = (size_t)fileSize.QuadPart;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL)
+		{
+			close();
+			return false;
+		}
+		data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+		{
+			close();
+			return false;
+		}
+		size = (size_t)fileStat.st_size;
+		void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		data = mapped != MAP_FAILED ? (const uint8_t*)mapped : nullptr;
+#endif
+		if (data == nullptr)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (data != nullptr)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data != nullptr)
+			munmap((void*)data, size);
+		if (fd >= 0)
+			::close(fd);
+		fd = -1;
+#endif
+		data = nullptr;
+		size = 0;
+	}
+};
+
+// Writes every chunk of space, returns false if the file could not be written
+bool VDWriteWorldFile(const char* path, const VDSpace& space)
+{
+	FILE* file = fopen(path, "wb");
+	if (file == nullptr)
+		return false;
+
+	VDWorldFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = VD_WORLD_FILE_MAGIC;
+	header.version = VD_WORLD_FILE_VERSION;
+	header.gridSize = space.gridSize;
+	header.anchor[0] = space.anchor.x;
+	header.anchor[1] = space.anchor.y;
+	header.anchor[2] = space.anchor.z;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	std::vector<VDWorldChunkEntry> directory;
+	directory.reserve(space.chunkCount());
+	uint64_t offset = sizeof(header);
+	const uint8_t padding[8] = {};
+	// Compressed chunks are written from scratch buffers so they keep their compact storage
+	std::vector<uint64_t> scratchWords;
+	std::vector<VDVoxel> scratchVoxels;
+	space.forEachChunk([&](VDVector3i coord, const VDGrid* pChunk)
+		{
+			VDWorldChunkEntry entry;
+			entry.coord[0] = coord.x;
+			entry.coord[1] = coord.y;
+			entry.coord[2] = coord.z;
+			entry.flags = 0;
+			entry.uniform = VD_CHUNK_MIXED;
+			entry.material = 0;
+			entry.offset = offset;
+			if (pChunk->isUniform())
+			{
+				entry.flags = VD_WORLD_CHUNK_UNIFORM;
+				entry.uniform = pChunk->uniform;
+				entry.material = pChunk->uniformVoxel.material;
+				directory.push_back(entry);
+				return;
+			}
+			const uint64_t* pOccupancy = pChunk->occupancy;
+			const VDVoxel* pVoxels = pChunk->voxels;
+			if (pChunk->isCompressed())
+			{
+				scratchWords.resize(pChunk->wordCount());
+				scratchVoxels.resize(pChunk->indexCount);
+				pChunk->expandInto(scratchWords.data(), scratchVoxels.data());
+				pOccupancy = scratchWords.data();
+				pVoxels = scratchVoxels.data();
+			}
+			for (VDuint i = 0; i < pChunk->indexCount; i++)
+			{
+				if (pVoxels[i].material != 0)
+				{
+					entry.flags |= VD_WORLD_CHUNK_HAS_MATERIALS;
+					break;
+				}
+			}
+			size_t occupancyBytes = (size_t)pChunk->rowWords * pChunk->gridSize * pChunk->gridSize * sizeof(uint64_t);
+			ok = ok && fwrite(pOccupancy, occupancyBytes, 1, file) == 1;
+			offset += occupancyBytes;
+			if (entry.flags & VD_WORLD_CHUNK_HAS_MATERIALS)
+			{
+				ok = ok && fwrite(pVoxels, pChunk->indexCount, 1, file) == 1;
+				offset += pChunk->indexCount;
+				size_t pad = (size_t)((8 - offset % 8) % 8);
+				ok = ok && (pad == 0 || fwrite(padding, pad, 1, file) == 1);
+				offset += pad;
+			}
+			directory.push_back(entry);
+		});
+
+	header.chunkCount = (uint32_t)directory.size();
+	header.directoryOffset = offset;
+	ok = ok && (directory.empty() || fwrite(directory.data(), sizeof(VDWorldChunkEntry), directory.size(), file) == directory.size());
+	ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = fclose(file) == 0 && ok;
+	return ok;
+}
+
+// A mapped world file. Opening only indexes the directory, chunks are built when asked for.
+// Loading is read only and may run on several threads at once, e.g. as a VDChunkLoader with the
+// coordinates shifted back by getChunkOffset.
+struct VDWorldFile
+{
+	VDMappedFile file;
+	const VDWorldFileHeader* pHeader;
+	const VDWorldChunkEntry* pDirectory;
+	VDHashMap<VDVector3i, VDuint> chunkEntries;
+	size_t occupancyBytes;
+
+	VDWorldFile()
+	{
+		pHeader = nullptr;
+		pDirectory = nullptr;
+		occupancyBytes = 0;
+	}
+
+	bool open(const char* path)
+	{
+		close();
+		if (!file.open(path) || file.size < sizeof(VDWorldFileHeader))
+		{
+			close();
+			return false;
+		}
+		pHeader = (const VDWorldFileHeader*)file.data;
+		if (pHeader->magic != VD_WORLD_FILE_MAGIC || pHeader->version != VD_WORLD_FILE_VERSION || pHeader->gridSize == 0
+			|| pHeader->directoryOffset % 8 != 0
+			|| pHeader->directoryOffset + (uint64_t)pHeader->chunkCount * sizeof(VDWorldChunkEntry) > file.size)
+		{
+			close();
+			return false;
+		}
+		VDuint gridSize = pHeader->gridSize;
+		occupancyBytes = (size_t)((gridSize + 63) / 64) * gridSize * gridSize * sizeof(uint64_t);
+		pDirectory = (const VDWorldChunkEntry*)(file.data + pHeader->directoryOffset);
+		chunkEntries.reserve(pHeader->chunkCount);
+		for (VDuint i = 0; i < pHeader->chunkCount; i++)
+		{
+			const VDWorldChunkEntry& entry = pDirectory[i];
+			chunkEntries.insert(VDVector3i(entry.coord[0], entry.coord[1], entry.coord[2]), i);
+		}
+		return true;
+	}
+
+	void close()
+	{
+		file.close();
+		chunkEntries.clear();
+		pHeader = nullptr;
+		pDirectory = nullptr;
+	}
+
+	bool isOpen() const
+	{
+		return pHeader != nullptr;
+	}
+
+	VDuint gridSize() const
+	{
+		return pHeader->gridSize;
+	}
+
+	VDVector3i anchor() const
+	{
+		return VDVector3i(pHeader->anchor[0], pHeader->anchor[1], pHeader->anchor[2]);
+	}
+
+	VDuint chunkCount() const
+	{
+		return pHeader->chunkCount;
+	}
+
+	bool contains(VDVector3i chunkCoord) const
+	{
+		return chunkEntries.contains(chunkCoord);
+	}
+
+	// Offset from the file's chunk coordinates to those of a space with gridSize and anchor, so stored
+	// chunks keep their world position. Returns false when the grid sizes differ or the anchors are
+	// not a whole number of chunks apart.
+	bool getChunkOffset(VDuint gridSize, VDVector3i anchor, VDVector3i& offset) const
+	{
+		if (gridSize != pHeader->gridSize)
+			return false;
+		VDVector3i difference = this->anchor() - anchor;
+		int size = (int)gridSize;
+		if (difference.x % size != 0 || difference.y % size != 0 || difference.z % size != 0)
+			return false;
+		offset = difference / size;
+		return true;
+	}
+
+	// Copies the stored chunk at chunkCoord, in the file's chunk coordinates, into chunk, which must
+	// have the file's grid size. Empty and solid chunks of one material end up uniform, those stored
+	// uniform are set up without touching voxel storage. Returns false when the file has no chunk there.
+	bool loadChunk(VDVector3i chunkCoord, VDGrid& chunk) const
+	{
+		const VDuint* pEntryIndex = chunkEntries.find(chunkCoord);
+		if (pEntryIndex == nullptr || chunk.gridSize != pHeader->gridSize)
+			return false;
+		const VDWorldChunkEntry& entry = pDirectory[*pEntryIndex];
+		if (entry.flags & VD_WORLD_CHUNK_UNIFORM)
+		{
+			if (entry.uniform != VD_CHUNK_EMPTY && entry.uniform != VD_CHUNK_SOLID)
+				return false;
+			chunk.setUniform(entry.uniform == VD_CHUNK_SOLID, entry.material);
+			return true;
+		}
+		bool hasMaterials = (entry.flags & VD_WORLD_CHUNK_HAS_MATERIALS) != 0;
+		uint64_t payload = occupancyBytes + (hasMaterials ? chunk.indexCount : 0);
+		if (entry.offset + payload > file.size)
+			return false;
+		chunk.materialize();
+		memcpy(chunk.occupancy, file.data + entry.offset, occupancyBytes);
+		if (hasMaterials)
+			memcpy(chunk.voxels, file.data + entry.offset + occupancyBytes, chunk.indexCount);
+		else
+			std::fill_n(chunk.voxels, chunk.indexCount, VDVoxel());
+		chunk.rebuildBricks();
+		chunk.makeUniform();
+		return true;
+	}
+
+	// Builds the stored chunk at chunkCoord, in space's chunk coordinates, into space unless space
+	// already has one there. Returns null when the file does not fit space, see getChunkOffset.
+	VDGrid* loadChunk(VDSpace& space, VDVector3i chunkCoord) const
+	{
+		VDVector3i offset;
+		if (!getChunkOffset(space.gridSize, space.anchor, offset))
+			return nullptr;
+		if (space.validateChunkCoord(chunkCoord))
+			return space.getChunk(chunkCoord);
+		VDGrid* pChunk = new VDGrid(space.gridSize, space.getChunkLow(chunkCoord), VD_INVALID_HANDLE_INDEX);
+		if (!loadChunk(chunkCoord - offset, *pChunk) || space.adoptChunk(chunkCoord, pChunk) == nullptr)
+		{
+			pChunk->release();
+			delete pChunk;
+			return nullptr;
+		}
+		return pChunk;
+	}
+
+	// Builds every stored chunk into space where space has none yet, loaded counts the chunks added.
+	// Returns false without touching space when the file does not fit it, see getChunkOffset.
+	bool loadAll(VDSpace& space, VDuint& loaded) const
+	{
+		loaded = 0;
+		VDVector3i offset;
+		if (!getChunkOffset(space.gridSize, space.anchor, offset))
+			return false;
+		space.reserve(space.chunkCount() + pHeader->chunkCount);
+		for (VDuint i = 0; i < pHeader->chunkCount; i++)
+		{
+			VDVector3i coord = VDVector3i(pDirectory[i].coord[0], pDirectory[i].coord[1], pDirectory[i].coord[2]) + offset;
+			if (!space.validateChunkCoord(coord) && loadChunk(space, coord) != nullptr)
+				loaded++;
+		}
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef TERRAIN_GENERATORS
+#define TERRAIN_GENERATORS
+
+#include "VoxelDynamicsTerrain.h"
+#include "FastNoiseLite.h"
+
+// Noise terrain for VDGenerateChunks or chunk streaming. Noise is sampled a row at a time into a
+// buffer and turned into occupancy words by VDThresholdBits.
+struct TerrainSettings
+{
+    int seed = 0;
+    // The surface varies by amplitude around baseHeight
+    float baseHeight = 64.0f;
+    float amplitude = 48.0f;
+    float frequency = 0.004f;
+    int octaves = 4;
+    // Caves carve out voxels where their noise is above caveThreshold
+    bool caves = true;
+    float caveFrequency = 0.02f;
+    float caveThreshold = 0.55f;
+};
+
+FastNoiseLite makeTerrainNoise(int seed, float frequency, int octaves)
+{
+    FastNoiseLite noise(seed);
+    noise.SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2);
+    noise.SetFrequency(frequency);
+    if (octaves > 1)
+    {
+        noise.SetFractalType(FastNoiseLite::FractalType_FBm);
+        noise.SetFractalOctaves(octaves);
+    }
+    return noise;
+}
+
+// Removes cave voxels from the occupied rows of a generated chunk, returns false when it ends up empty
+bool carveCaves(VDGrid& chunk, const FastNoiseLite& caveNoise, float threshold, std::vector<float>& row)
+{
+    VDuint size = chunk.gridSize;
+    bool any = false;
+    for (VDuint z = 0; z < size; z++)
+    {
+        for (VDuint y = 0; y < size; y++)
+        {
+            uint64_t* pRow = chunk.occupancy + chunk.rowWord(y, z);
+            bool occupied = false;
+            for (VDuint word = 0; word < chunk.rowWords; word++)
+                occupied = occupied || pRow[word] != 0;
+            if (!occupied)
+                continue;
+            for (VDuint x = 0; x < size; x++)
+                row[x] = caveNoise.GetNoise(chunk.low.x + x + 0.5f, chunk.low.y + y + 0.5f, chunk.low.z + z + 0.5f);
+            for (VDuint word = 0; word < chunk.rowWords; word++)
+            {
+                pRow[word] &= ~VDThresholdBits(row.data() + word * 64, VDMin(size - word * 64, 64u), threshold);
+                any = any || pRow[word] != 0;
+            }
+        }
+    }
+    return any;
+}
+
+// Rolling surface from 2D noise, optionally hollowed out by 3D cave noise
+VDChunkLoader heightmapGenerator(const TerrainSettings& settings)
+{
+    FastNoiseLite surfaceNoise = makeTerrainNoise(settings.seed, settings.frequency, settings.octaves);
+    FastNoiseLite caveNoise = makeTerrainNoise(settings.seed + 1, settings.caveFrequency, 1);
+    return [settings, surfaceNoise, caveNoise](VDVector3i /*chunkCoord*/, VDGrid& chunk)
+        {
+            // Chunks above the highest possible surface are empty without sampling any noise
+            if (chunk.low.y >= settings.baseHeight + settings.amplitude)
+                return false;
+            VDuint size = chunk.gridSize;
+            std::vector<float> heights(size * size);
+            for (VDuint z = 0; z < size; z++)
+            {
+                for (VDuint x = 0; x < size; x++)
+                    heights[x + z * size] = settings.baseHeight + settings.amplitude * surfaceNoise.GetNoise(chunk.low.x + x + 0.5f, chunk.low.z + z + 0.5f);
+            }
+            if (!VDFillHeightmap(chunk, heights.data()))
+                return false;
+            if (!settings.caves)
+                return true;
+            return carveCaves(chunk, caveNoise, settings.caveThreshold, heights);
+        };
+}
+
+// 3D density terrain with overhangs, solid where the noise outweighs the height above baseHeight
+VDChunkLoader densityGenerator(const TerrainSettings& settings)
+{
+    FastNoiseLite densityNoise = makeTerrainNoise(settings.seed, settings.frequency, settings.octaves);
+    FastNoiseLite caveNoise = makeTerrainNoise(settings.seed + 1, settings.caveFrequency, 1);
+    return [settings, densityNoise, caveNoise](VDVector3i /*chunkCoord*/, VDGrid& chunk)
+        {
+            // Noise stays within [-1, 1], so the density only crosses zero within amplitude of baseHeight
+            if (chunk.low.y >= settings.baseHeight + settings.amplitude)
+                return false;
+            VDuint size = chunk.gridSize;
+            std::vector<float> row(size);
+            bool any = false;
+            for (VDuint z = 0; z < size; z++)
+            {
+                for (VDuint y = 0; y < size; y++)
+                {
+                    float worldY = chunk.low.y + y + 0.5f;
+                    float bias = (settings.baseHeight - worldY) / settings.amplitude;
+                    if (bias > 1.0f)
+                    {
+                        for (VDuint word = 0; word < chunk.rowWords; word++)
+                            chunk.occupancy[chunk.rowWord(y, z) + word] = chunk.fullWord(word);
+                        any = true;
+                        continue;
+                    }
+                    if (bias < -1.0f)
+                        continue;
+                    for (VDuint x = 0; x < size; x++)
+                        row[x] = densityNoise.GetNoise(chunk.low.x + x + 0.5f, worldY, chunk.low.z + z + 0.5f) + bias;
+                    VDFillRow(chunk, y, z, row.data(), 0.0f);
+                    any = true;
+                }
+            }
+            if (!any)
+                return false;
+            if (!settings.caves)
+                return true;
+            return carveCaves(chunk, caveNoise, settings.caveThreshold, row);
+        };
+}
+
+#endif
@@ -8,6 +8,7 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "FastNoiseLite.h"
+#include "TerrainGenerators.h"
 
 
 VDuint WINDOW_WIDTH = 1268;
@@ -300,7 +301,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
 struct VoxelRenderResource
 {
     VDuint arrayPos;
-    VDVoxel* pVoxel;
+    VDVoxelRef voxel;
 };
 
 
@@ -348,10 +349,10 @@ struct InstanceBufferData
         return instancePositions.size() - 1;
     }
 
-    void insertVoxel(VDVoxel* pVoxel, int textInd = 0)
+    void insertVoxel(VDVoxelRef voxel, int textInd = 0)
     {
-        VDuint ind = insert(pVoxel->lowPosition, textInd);
-        pVoxel->userData.value = ind;
+        VDuint ind = insert(voxel.lowPosition(), textInd);
+        voxel.setUserData((uintptr_t)ind);
     }
 
     void remove(VDuint index)
@@ -361,11 +362,23 @@ struct InstanceBufferData
         instanceTexts[index] = -2;
     }
 
-    void removeVoxel(VDVoxel* pVoxel)
+    void removeVoxel(VDVoxelRef voxel)
     {
-        VDuint index = pVoxel->userData.value;
+        VDuint index = voxel.getUserData().value;
         remove(index);
     }
+
+    // Replaces the instances with the occupied voxels of chunk, for edits too large to patch
+    void rebuild(VDGrid& chunk, int textInd = 0)
+    {
+        instancePositions.clear();
+        instanceTexts.clear();
+        freeIndices.free();
+        VDList<VDVoxelRef> voxelList = chunk.getOccupiedVoxels();
+        for (auto it = voxelList.pFirst; it != nullptr; it = it->pNext)
+            insertVoxel(it->item, textInd);
+        voxelList.free();
+    }
 };
 
 
@@ -534,18 +547,17 @@ struct InstanceBuffer : VertexBuffer
     static InstanceBuffer instanceBufferFromChunk(VDGrid& chunk, VDuint capacity, int texInd = 0)
     {
         std::vector<int> texts;
-        VDList<VDVoxel*> voxelList = chunk.getOccupiedVoxels();
+        VDList<VDVoxelRef> voxelList = chunk.getOccupiedVoxels();
         voxelList.autoFree = true;
-        std::vector<VDVoxel*> occupiedVector = voxelList.toVector();
+        std::vector<VDVoxelRef> occupiedVector = voxelList.toVector();
         std::vector<VDVector3> posesVec;
         
         InstanceBuffer ib;
         for (int i = 0; i < occupiedVector.size(); i++)
         {
-            posesVec.push_back(occupiedVector[i]->lowPosition);
+            posesVec.push_back(occupiedVector[i].lowPosition());
             texts.push_back(texInd);
-            occupiedVector[i]->userData = (VDPointer)i;
-            chunk.setVoxel(occupiedVector[i]->index, *occupiedVector[i]);
+            occupiedVector[i].setUserData((uintptr_t)i);
         }
         ib.init(vbPositiveQuadrant, posesVec, texts, capacity);
         return ib;
@@ -925,7 +937,7 @@ void drawTranslatedWireFrameVertexBuffer(const VertexBuffer& vertexBuffer, VDVec
     vertexBuffer.draw(GL_LINES);
 }
 
-void drawVoxel(const VDVoxel& voxel, VDVector3 color)
+void drawVoxel(const VDVoxelRef& voxel, VDVector3 color)
 {
     wireShader.use();
     wireShader.setUniformVector3("solidColor", color);
@@ -997,17 +1009,10 @@ void drawSpace(const VDSpace& space, VDVector3 color)
     VDVector3 halfExtents((float)space.gridSize * 0.5f,
         (float)space.gridSize * 0.5f, (float)space.gridSize * 0.5f);
     VDVector3 fullExtents = halfExtents * 2.0f;
-    for (VDuint z = 0; z < space.horizontalGrids; z++)
-    {
-        for (VDuint y = 0; y < space.verticalGrids; y++)
+    space.forEachChunk([&](VDVector3i coord, VDGrid* pChunk)
         {
-            for (VDuint x = 0; x < space.horizontalGrids; x++)
-            {
-                VDVector3i anchor = space.anchor + VDVector3i(x, y, z) * space.gridSize;
-                drawWireFrameVertexBuffer(vbWire, anchor + halfExtents, { 0,0,0 }, fullExtents, color);
-            }
-        }
-    }
+            drawWireFrameVertexBuffer(vbWire, space.getChunkLow(coord) + halfExtents, { 0,0,0 }, fullExtents, color);
+        });
 }
 
 void drawInstanceBuffer(const InstanceBuffer& instanceBuffer, const TextureArray& texArr)
@@ -4,10 +4,9 @@
 struct HelloBodyScene : Scene
 {
     VDSimulation sim;
-    VDAgentController* pController;
     InstanceBuffer ib;
-    std::vector<VDBody*> pBodyStack;
-    VDBody* pControllable;
+    std::vector<VDHandle> bodyStack;
+    VDHandle controllable;
     void init() override
     {
         camera.position += VDVector3(0, 5, 0);
@@ -24,13 +23,13 @@ struct HelloBodyScene : Scene
        {
            for (int j = 0; j <= i; j++)
            {
-               VDBody* pBody = sim.createAABBBody(VDAABB::fromMidPointAndHalfExtents(VDVector3::half(), VDVector3(j, 1.5+i, 0)), 1.0f);
-               //pBody->setSleeping(true);
-               pBodyStack.push_back(pBody);
+               VDHandle body = sim.createAABBBody(VDAABB::fromMidPointAndHalfExtents(VDVector3::half(), VDVector3(j, 1.5+i, 0)), 1.0f);
+               //sim.getBody(body).setSleeping(true);
+               bodyStack.push_back(body);
            }
        }
        //pBody = sim.createAABBBody(VDAABB::fromMidPointAndHalfExtents(VDVector3::half(), VDVector3(0, 8, 0)), 1.0f);
-       pControllable = sim.createAABBBody(VDAABB::fromMidPointAndHalfExtents(VDVector3::half(), VDVector3(0, 10, 0)), 1.0f);
+       controllable = sim.createAABBBody(VDAABB::fromMidPointAndHalfExtents(VDVector3::half(), VDVector3(0, 10, 0)), 1.0f);
     }
 
     void update(float dt) override
@@ -39,25 +38,27 @@ struct HelloBodyScene : Scene
         sim.simulate(dt);
         if (keysDown[GLFW_KEY_SPACE])
         {
-            pControllable->sleeping = false;
-            pControllable->setPosition(camera.position);
-            pControllable->clearForces();
-            pControllable->deltaMomentums.insert(camera.forward * 20.0f);
-            pControllable->momentum = VDVector3();
+            VDBodyRef body = sim.getBody(controllable);
+            body.setSleeping(false);
+            body.setPosition(camera.position);
+            body.clearForces();
+            body.addDeltaMomentum(camera.forward * 20.0f);
+            body.momentum() = VDVector3();
         }
     }
 
     void draw(float dt) override
     {
         drawInstanceBuffer(ib, texArr);
-        for (int i = 0; i < pBodyStack.size(); i++)
+        for (int i = 0; i < bodyStack.size(); i++)
         {
-            if(pBodyStack[i]->sleeping)
-                drawSolidAABB(*pBodyStack[i], { 1,0,0 });
+            VDBodyRef body = sim.getBody(bodyStack[i]);
+            if(body.isSleeping())
+                drawSolidAABB(body.toAABB(), { 1,0,0 });
             else
-                drawSolidAABB(*pBodyStack[i], { 0,1,0 });
+                drawSolidAABB(body.toAABB(), { 0,1,0 });
         }
-        drawSolidAABB(*pControllable, { 1,1,1 });
+        drawSolidAABB(sim.getBody(controllable).toAABB(), { 1,1,1 });
     }
 };
 
@@ -4,19 +4,15 @@
 struct HelloVoxelDynamicsScene : Scene
 {
     VDSimulation sim;
-    VDAgentController* pController;
+    VDHandle controller;
     std::vector<InstanceBuffer> ibs;
+    // Journal version the instance buffers reflect
+    uint64_t seenVersion = 0;
     void init() override
     {
         texArr.initCheckersTexture(0);
         sim = VDSimulation(20, { -20,-20,-20 }, 2, 2);
-        for (int i = -10; i <= 10; i++)
-        {
-            for (int j = -10; j <= 10; j++)
-            {
-                sim.space.setVoxelOccupied({ (float)i, 0, (float)j });
-            }
-        }
+        VDEditBox(sim.space, VDAABB(VDVector3(-10, 0, -10), VDVector3(11, 1, 11)), true);
         for (int i = 0; i < 2; i++)
         {
             for (int j = 0; j < 2; j++)
@@ -36,49 +32,77 @@ struct HelloVoxelDynamicsScene : Scene
                 sim.space.grids[i].pChunk->userData = &ibs[i];
             }
         }
-        pController = sim.createAgentController(VDVector3(0, 2, 0), VDVector3(0.3, 0.8, 0.3), 3.0f);
+        seenVersion = sim.space.journal->version;
+        controller = sim.createAgentController(VDVector3(0, 2, 0), VDVector3(0.3, 0.8, 0.3), 3.0f);
     }
 
     void update(float dt) override
     {
         Scene::update(dt);
+        VDAgentController* pController = sim.getAgentController(controller);
         moveAgentWithArrows(camera, *pController, dt, pController->speed);
         camera.position = pController->position + VDVector3(0, pController->halfExtents.y, 0);
         sim.simulate(dt);
-		VDGrid* pGrid = sim.space.getGrid(camera.position);
-		if (pGrid != nullptr)
-		{
-            VDVoxel* pVoxel = sim.space.getVoxel(camera.position + camera.forward * 2.5f);
-            if (pVoxel)
+        VDRayHit hit;
+        if (sim.space.rayCast(camera.position, camera.forward, 8.0f, hit))
+        {
+            drawVoxel(hit.voxel, { 0,0,1 });
+            if (keysDown[GLFW_KEY_Q])
+            {
+                // Place against the face the ray hit
+                VDVoxelRef voxel = sim.space.getVoxel(hit.point + hit.normal * 0.5f);
+                if (voxel.isValid())
+                    voxel.setOccupied(true);
+            }
+            if (keysDown[GLFW_KEY_E])
+                hit.voxel.setOccupied(false);
+        }
+        syncInstanceBuffers();
+    }
+
+    // Patches the instance buffers with the voxel edits journaled since the last sync. Chunks with
+    // region edits are rebuilt, all of them when the journal dropped changes not seen yet.
+    void syncInstanceBuffers()
+    {
+        std::vector<VDGrid*> rebuilt;
+        bool complete = sim.space.journal->pull(seenVersion, [&](const VDChunkChange& change)
             {
-                drawVoxel(*pVoxel, { 0,0,1 });
-                if (keysDown[GLFW_KEY_Q])
+                VDGrid* pChunk = sim.space.getChunk(change.chunkCoord);
+                if (pChunk == nullptr || pChunk->userData.value == 0)
+                    return;
+                if (change.type == VD_CHANGE_REGION)
                 {
-                    VDGrid* PVoxelGrid = sim.space.grids[pVoxel->chunkIndex].pChunk;
-                    InstanceBuffer* pBuffer = PVoxelGrid->userData;
-                    if (!pVoxel->occupied)
-                    {
-                        pVoxel->occupied = true;
-                        pBuffer->data.insertVoxel(pVoxel);
-                        pBuffer->bind();
-                        pBuffer->updateInstanceBuffer();
-                    }
+                    if (std::find(rebuilt.begin(), rebuilt.end(), pChunk) == rebuilt.end())
+                        rebuilt.push_back(pChunk);
+                    return;
                 }
-                if (keysDown[GLFW_KEY_E])
+                if (change.type != VD_CHANGE_VOXEL || change.wasOccupied == change.occupied)
+                    return;
+                InstanceBuffer* pBuffer = pChunk->userData;
+                VDVoxelRef voxel = pChunk->voxelRef(change.index);
+                if (change.occupied)
+                    pBuffer->data.insertVoxel(voxel);
+                else
+                    pBuffer->data.removeVoxel(voxel);
+                pBuffer->bind();
+                pBuffer->updateInstanceBuffer();
+            });
+        if (!complete)
+        {
+            rebuilt.clear();
+            sim.space.forEachChunk([&](VDVector3i, const VDGrid* pChunk)
                 {
-                    VDGrid* PVoxelGrid = sim.space.grids[pVoxel->chunkIndex].pChunk;
-                    InstanceBuffer* pBuffer = PVoxelGrid->userData;
-                    if (pVoxel->occupied)
-                    {
-                        pVoxel->occupied = false;
-                        pBuffer->data.removeVoxel(pVoxel);
-                        pBuffer->bind();
-                        pBuffer->updateInstanceBuffer();
-                    }
-                }
-            }
-		}
-
+                    if (pChunk->userData.value != 0)
+                        rebuilt.push_back(const_cast<VDGrid*>(pChunk));
+                });
+        }
+        for (size_t i = 0; i < rebuilt.size(); i++)
+        {
+            InstanceBuffer* pBuffer = rebuilt[i]->userData;
+            pBuffer->data.rebuild(*rebuilt[i]);
+            pBuffer->bind();
+            pBuffer->updateInstanceBuffer();
+        }
     }
 
     void draw(float dt) override
@@ -0,0 +1,1065 @@
+#include <cstdio>
+#include <random>
+#include <unordered_map>
+#include "VoxelDynamicsSimulation.h"
+#include "VoxelDynamicsWorldFile.h"
+#include "TerrainGenerators.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+// Every stored entry must sit exactly its probe distance after its home slot, which
+// backshift deletion has to keep true without tombstones
+template <typename K, typename V>
+static bool hashMapConsistent(const VDHashMap<K, V>& map)
+{
+    VDuint stored = 0;
+    for (VDuint i = 0; i < map.capacity; i++)
+    {
+        if (map.distances[i] == 0)
+            continue;
+        stored++;
+        VDuint home = map.homeSlot(map.entries[i].key);
+        if (((i - home) & (map.capacity - 1)) + 1 != map.distances[i])
+            return false;
+    }
+    return stored == map.count;
+}
+
+static void testHashMap()
+{
+    VDHashMap<int, int> map;
+    std::unordered_map<int, int> reference;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 50000; i++)
+    {
+        // Few keys keep the table near its load limit, so removals shift long runs back
+        int key = (int)(rng() % 600);
+        switch (rng() % 3)
+        {
+        case 0:
+            map.insert(key, i);
+            reference[key] = i;
+            break;
+        case 1:
+            CHECK(map.remove(key) == (reference.erase(key) == 1));
+            break;
+        default:
+        {
+            int* pValue = map.find(key);
+            auto it = reference.find(key);
+            CHECK((pValue != nullptr) == (it != reference.end()));
+            if (pValue != nullptr && it != reference.end())
+                CHECK(*pValue == it->second);
+        }
+        }
+        CHECK(map.count == reference.size());
+        if (i % 1000 == 0)
+            CHECK(hashMapConsistent(map));
+    }
+
+    // Removing everything and inserting again reuses the slots
+    for (auto& entry : reference)
+        CHECK(map.remove(entry.first));
+    CHECK(map.count == 0);
+    for (VDuint i = 0; i < map.capacity; i++)
+        CHECK(map.distances[i] == 0);
+    for (int key = 0; key < 600; key++)
+        map.insert(key, -key);
+    CHECK(hashMapConsistent(map));
+    for (int key = 0; key < 600; key++)
+        CHECK(map.find(key) != nullptr && *map.find(key) == -key);
+
+    VDHashMap<VDVector3i, VDuint> coords;
+    for (int i = 0; i < 1000; i++)
+        coords.insert(VDVector3i(i, -i, i * 2), (VDuint)i);
+    for (int i = 0; i < 1000; i += 2)
+        CHECK(coords.remove(VDVector3i(i, -i, i * 2)));
+    CHECK(hashMapConsistent(coords));
+    for (int i = 0; i < 1000; i++)
+        CHECK((coords.find(VDVector3i(i, -i, i * 2)) != nullptr) == (i % 2 == 1));
+}
+
+// Pooled object with a constructor and a size that is not a power of two
+struct TestPooled
+{
+    uint64_t words[3];
+    int marker;
+
+    TestPooled()
+    {
+        words[0] = words[1] = words[2] = 0;
+        marker = 7;
+    }
+};
+
+static void testSlabPool()
+{
+    VDObjectPool<TestPooled> pool(8, 1);
+    std::vector<TestPooled*> objects;
+    for (int i = 0; i < 8; i++)
+        objects.push_back(static_cast<TestPooled*>(pool.allocate()));
+    // One slab hands out its slots in address order
+    CHECK(pool.slabs.size() == 1);
+    bool contiguous = true;
+    for (int i = 0; i < 8; i++)
+        contiguous = contiguous && (char*)objects[i] == (char*)objects[0] + i * pool.slotSize && objects[i]->marker == 7;
+    CHECK(contiguous);
+    CHECK(pool.slotSize % alignof(TestPooled) == 0);
+
+    objects.push_back(static_cast<TestPooled*>(pool.allocate()));
+    CHECK(pool.slabs.size() == 2);
+    // The free list reuses the latest freed slot first
+    objects[3]->marker = 0;
+    pool.free(objects[3]);
+    TestPooled* pReused = static_cast<TestPooled*>(pool.allocate());
+    CHECK(pReused == objects[3] && pReused->marker == 7);
+
+    // Trimming releases slabs without live objects but keeps one
+    pool.free(objects[8]);
+    CHECK(pool.trim() == 1);
+    CHECK(pool.slabs.size() == 1);
+    // Freed back to front, the slots come out in address order again
+    for (int i = 8; i > 0; i--)
+        pool.free(objects[i - 1]);
+    CHECK(pool.trim() == 0);
+    CHECK(pool.slabs.size() == 1);
+    for (int i = 0; i < 8; i++)
+        CHECK(static_cast<TestPooled*>(pool.allocate()) == objects[i]);
+}
+
+static void testTypedPools()
+{
+    VDAllocator allocator;
+    // Typed and runtime paths share one pool per type and array size
+    TestPooled* pTyped = allocator.allocateTyped<TestPooled, 4>();
+    CHECK(pTyped[0].marker == 7 && pTyped[3].marker == 7);
+    VDBaseObjectPool* pTypedPool = allocator.getTypedPool<TestPooled, 4>();
+    CHECK(allocator.getRuntimePool<TestPooled>(4, 0, false) == pTypedPool);
+    TestPooled* pRuntime = allocator.allocate<TestPooled>(4);
+    CHECK(pRuntime != pTyped);
+    allocator.free(pTyped, 4);
+    allocator.freeTyped<TestPooled, 4>(pRuntime);
+    CHECK((allocator.getTypedPool<TestPooled, 2>() != allocator.getTypedPool<TestPooled, 4>()));
+
+    // createPool keeps an existing pool and refuses to change its capacity
+    VDObjectPool<TestPooled>* pCreated = allocator.createPool<TestPooled>(16, 6);
+    CHECK(pCreated->capacity == 16);
+    CHECK(allocator.createPool<TestPooled>(16, 6) == pCreated);
+    CHECK((allocator.getTypedPool<TestPooled, 6>() == pCreated));
+    bool threw = false;
+    try
+    {
+        allocator.createPool<TestPooled>(32, 6);
+    }
+    catch (const std::runtime_error&)
+    {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(allocator.createPool<TestPooled>(16, 6) == pCreated);
+
+    // Allocators keep their own pools
+    VDAllocator other;
+    CHECK((other.getTypedPool<TestPooled, 4>() != pTypedPool));
+}
+
+static void testFrameArenas()
+{
+    // A step rewinds the arena of the thread running it
+    VDSimulation simulation(16, VDVector3i(0, 0, 0));
+    VDFrameArena::local().allocate<uint64_t>(64);
+    CHECK(VDFrameArena::local().offset > 0);
+    simulation.simulate(1.0f / 60.0f);
+    CHECK(VDFrameArena::local().offset == 0);
+
+    // but leaves the lists other threads are still building alone
+    std::mutex mutex;
+    std::condition_variable changed;
+    int stage = 0;
+    bool intact = false;
+    std::thread query([&]()
+        {
+            VDList<int> list(&VDFrameArena::local());
+            for (int i = 0; i < 100; i++)
+                list.insert(i);
+            size_t offset = VDFrameArena::local().offset;
+            std::unique_lock<std::mutex> lock(mutex);
+            stage = 1;
+            changed.notify_all();
+            changed.wait(lock, [&] { return stage == 2; });
+            // Nodes allocated after a rewind would overwrite the ones above
+            VDList<int> other(&VDFrameArena::local());
+            for (int i = 0; i < 100; i++)
+                other.insert(-1);
+            int expected = 99;
+            intact = VDFrameArena::local().offset > offset;
+            for (auto it = list.pFirst; it != nullptr; it = it->pNext)
+                intact = intact && it->item == expected--;
+        });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return stage == 1; });
+        simulation.simulate(1.0f / 60.0f);
+        stage = 2;
+        changed.notify_all();
+    }
+    query.join();
+    CHECK(intact);
+}
+
+static void testAllocatorStats()
+{
+    VDFrameArena::local().reset();
+    VDArenaStats before = gAllocator.getArenaStats();
+    CHECK(before.bytesUsed == 0);
+    VDFrameArena::local().allocate<uint64_t>(1000);
+    VDArenaStats during = gAllocator.getArenaStats();
+    CHECK(during.arenaCount >= 1);
+    CHECK(during.bytesUsed >= 1000 * sizeof(uint64_t));
+    CHECK(during.bytesReserved >= during.bytesUsed);
+    CHECK(during.highWaterMark >= during.bytesUsed);
+    VDFrameArena::local().reset();
+    CHECK(gAllocator.getArenaStats().highWaterMark >= during.bytesUsed);
+    CHECK(gAllocator.statsToText().find("frame arenas") != std::string::npos);
+    CHECK(gAllocator.statsToJSON().find("\"frameArenas\"") != std::string::npos);
+}
+
+static void testHandles()
+{
+    VDSimulation simulation(16, VDVector3i(-8, 0, -8));
+    std::vector<VDHandle> bodies;
+    for (int i = 0; i < 4; i++)
+        bodies.push_back(simulation.createAABBBody(VDAABB::fromMidPointAndHalfExtents(VDVector3::half(), VDVector3(i * 3.0f, 5.0f, 0.0f)), 1.0f));
+    VDVector3 kept = simulation.getBody(bodies[3]).position();
+
+    // A removed body's handle goes stale and stays stale when its slot is reused
+    CHECK(simulation.removeBody(bodies[1]));
+    CHECK(!simulation.removeBody(bodies[1]));
+    CHECK(!simulation.getBody(bodies[1]).isValid());
+    VDHandle reused = simulation.createAABBBody(VDAABB::fromMidPointAndHalfExtents(VDVector3::half(), VDVector3(0.0f, 9.0f, 0.0f)), 1.0f);
+    CHECK(reused.index == bodies[1].index && reused != bodies[1]);
+    CHECK(!simulation.getBody(bodies[1]).isValid());
+    CHECK(simulation.getBody(reused).isValid());
+    // The others keep pointing at their own bodies after the dense arrays moved
+    CHECK(simulation.getBody(bodies[3]).isValid() && simulation.getBody(bodies[3]).position() == kept);
+
+    VDHandle agent = simulation.createAgentController(VDVector3(0.0f, 3.0f, 0.0f), VDVector3(0.3f, 0.8f, 0.3f), 3.0f);
+    CHECK(simulation.getAgentController(agent) != nullptr);
+    CHECK(simulation.removeAgentController(agent));
+    CHECK(simulation.getAgentController(agent) == nullptr);
+    CHECK(!simulation.removeAgentController(agent));
+
+    // Chunk handles go stale when the chunk is removed, even if the coordinates are filled again
+    VDSpace& space = simulation.space;
+    space.setVoxelOccupied(VDVector3(1.5f, 1.5f, 1.5f));
+    VDHandle chunk = space.getChunkHandle(VDVector3i(0, 0, 0));
+    CHECK(space.getChunk(chunk) != nullptr);
+    space.removeChunk(VDVector3i(0, 0, 0));
+    CHECK(space.getChunk(chunk) == nullptr);
+    space.setVoxelOccupied(VDVector3(1.5f, 1.5f, 1.5f));
+    CHECK(space.getChunk(chunk) == nullptr);
+    CHECK(space.getChunk(space.getChunkHandle(VDVector3i(0, 0, 0))) != nullptr);
+}
+
+static bool sameCoord(VDVector3i a, VDVector3i b)
+{
+    return VDHashTraits<VDVector3i>::equal(a, b);
+}
+
+static void testNegativeChunks()
+{
+    VDSimulation simulation(16, VDVector3i(0, 0, 0));
+    VDSpace& space = simulation.space;
+    // Chunk coordinates round towards negative infinity
+    CHECK(sameCoord(space.getChunkCoord(VDVector3(-0.5f, 0.5f, 15.5f)), VDVector3i(-1, 0, 0)));
+    CHECK(sameCoord(space.getChunkCoord(VDVector3(-16.0f, -0.5f, 16.0f)), VDVector3i(-1, -1, 1)));
+    CHECK(sameCoord(space.getChunkCoord(VDVector3(-16.5f, 0.5f, 0.5f)), VDVector3i(-2, 0, 0)));
+    CHECK(sameCoord(space.getCellChunkCoord(VDVector3i(-1, 0, -17)), VDVector3i(-1, 0, -2)));
+    CHECK(!space.validateChunkCoord(VDVector3i(-1, 0, -1)));
+
+    // A floor around the origin spreads over four chunks, two of them at negative coordinates
+    for (int z = -4; z < 4; z++)
+    {
+        for (int x = -4; x < 4; x++)
+            space.setVoxelOccupied(VDVector3(x + 0.5f, 0.5f, z + 0.5f));
+    }
+    CHECK(space.chunkCount() == 4);
+    CHECK(space.validateChunkCoord(VDVector3i(-1, 0, -1)));
+    CHECK(sameCoord(space.getChunkLow(VDVector3i(-1, 0, -1)), VDVector3i(-16, 0, -16)));
+    CHECK(space.getVoxel(VDVector3(-3.5f, 0.5f, -3.5f)).isOccupied());
+    CHECK(!space.getVoxel(VDVector3(-3.5f, 1.5f, -3.5f)).isOccupied());
+
+    // A body straddling the chunk borders lands on the floor instead of falling through
+    VDHandle body = simulation.createAABBBody(VDAABB::fromMidPointAndHalfExtents(VDVector3::half(), VDVector3(0.0f, 3.0f, 0.0f)), 1.0f);
+    for (int i = 0; i < 180; i++)
+        simulation.simulate(1.0f / 60.0f);
+    VDVector3 position = simulation.getBody(body).position();
+    CHECK(fabsf(position.y - 1.5f) < 0.05f);
+    CHECK(fabsf(position.x) < 0.05f && fabsf(position.z) < 0.05f);
+}
+
+// Steps the simulation until done() holds, streaming workers finish on their own time
+template <typename F>
+static bool simulateUntil(VDSimulation& simulation, F done)
+{
+    for (int i = 0; i < 2000; i++)
+    {
+        if (done())
+            return true;
+        simulation.simulate(1.0f / 60.0f);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return done();
+}
+
+static void testStreaming()
+{
+    VDSimulation simulation(8, VDVector3i(0, 0, 0));
+    simulation.gravity = VDVector3();
+    // A hand made chunk outside the streamed region is never evicted
+    simulation.space.setVoxelOccupied(VDVector3(-39.5f, 0.5f, 0.5f));
+
+    VDStreamingSettings settings;
+    settings.horizontalRadius = 1;
+    settings.verticalRadius = 1;
+    settings.maxResidentChunks = 9;
+    settings.workerCount = 2;
+    std::mutex mutex;
+    std::vector<VDVector3i> saved;
+    bool savedFloors = true;
+    // Only the layer at chunk height 0 has a floor, the chunks above and below come back empty
+    simulation.enableStreaming(settings,
+        [](VDVector3i chunkCoord, VDGrid& chunk)
+        {
+            if (chunkCoord.y != 0)
+                return false;
+            for (VDuint z = 0; z < chunk.gridSize; z++)
+            {
+                for (VDuint x = 0; x < chunk.gridSize; x++)
+                    chunk.setOccupied(chunk.getIndex(x, 0, z));
+            }
+            return true;
+        },
+        [&](VDVector3i chunkCoord, const VDGrid& chunk)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            saved.push_back(chunkCoord);
+            savedFloors = savedFloors && chunk.getOccupied(0u, 0u, 0u) && !chunk.getOccupied(0u, 1u, 0u);
+        });
+    VDHandle agent = simulation.createAgentController(VDVector3(4.0f, 4.0f, 4.0f), VDVector3(0.3f, 0.8f, 0.3f), 3.0f);
+    simulation.addStreamingAgent(agent);
+
+    // The nine floor chunks around the agent are adopted, the empty ones are not
+    CHECK(simulateUntil(simulation, [&] { return simulation.space.chunkCount() == 10; }));
+    for (int z = -1; z <= 1; z++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            CHECK(simulation.space.validateChunkCoord(VDVector3i(x, 0, z)));
+            CHECK(!simulation.space.validateChunkCoord(VDVector3i(x, 1, z)));
+            CHECK(!simulation.space.validateChunkCoord(VDVector3i(x, -1, z)));
+        }
+    }
+    CHECK(simulation.space.getVoxel(VDVector3(-3.5f, 0.5f, 11.5f)).isOccupied());
+
+    // Moving away loads the floor around the new position and evicts the old chunks through the saver
+    simulation.getAgentController(agent)->translate(VDVector3(80.0f, 0.0f, 0.0f));
+    CHECK(simulateUntil(simulation, [&]
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return saved.size() == 9 && simulation.space.chunkCount() == 10;
+        }));
+    for (size_t i = 0; i < saved.size(); i++)
+        CHECK(saved[i].x >= -1 && saved[i].x <= 1 && saved[i].y == 0 && saved[i].z >= -1 && saved[i].z <= 1);
+    for (int z = -1; z <= 1; z++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            CHECK(!simulation.space.validateChunkCoord(VDVector3i(x, 0, z)));
+            CHECK(simulation.space.validateChunkCoord(VDVector3i(10 + x, 0, z)));
+        }
+    }
+    CHECK(simulation.space.validateChunkCoord(VDVector3i(-5, 0, 0)));
+    CHECK(savedFloors);
+
+    // Stale agents stop acting as focus points and their chunks go too once a new focus needs the room
+    simulation.removeAgentController(agent);
+    VDHandle other = simulation.createAgentController(VDVector3(4.0f, 4.0f, 84.0f), VDVector3(0.3f, 0.8f, 0.3f), 3.0f);
+    simulation.addStreamingAgent(other);
+    CHECK(simulateUntil(simulation, [&]
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return saved.size() == 18;
+        }));
+    CHECK(simulation.space.validateChunkCoord(VDVector3i(0, 0, 10)));
+    CHECK(!simulation.space.validateChunkCoord(VDVector3i(10, 0, 0)));
+}
+
+// Voxels whose presence, occupancy or material differ between the spaces around the origin
+static VDuint countDifferences(VDSpace& a, VDSpace& b)
+{
+    VDuint differences = 0;
+    for (int x = -40; x < 40; x++)
+    {
+        for (int z = -40; z < 40; z++)
+        {
+            for (int y = -62; y < 25; y++)
+            {
+                VDVector3 position(x + 0.5f, y + 0.5f, z + 0.5f);
+                VDVoxelRef voxelA = a.getVoxel(position);
+                VDVoxelRef voxelB = b.getVoxel(position);
+                if (voxelA.isValid() != voxelB.isValid())
+                    differences++;
+                else if (voxelA.isValid() && (voxelA.isOccupied() != voxelB.isOccupied() || voxelA.readVoxel().material != voxelB.readVoxel().material))
+                    differences++;
+            }
+        }
+    }
+    return differences;
+}
+
+static void testWorldFile()
+{
+    const char* path = "VoxelDynamicsTests.vdw";
+    VDSpace space(20, VDVector3i(-7, 0, 3));
+    for (int x = -30; x < 30; x++)
+    {
+        for (int z = -30; z < 30; z++)
+        {
+            for (int y = -3; y < (x * z) % 5; y++)
+                space.setVoxelOccupied(VDVector3(x + 0.5f, y + 0.5f, z + 0.5f));
+        }
+    }
+    space.getVoxel(VDVector3(1.5f, 0.5f, 1.5f)).voxel().material = 7;
+    space.setChunkUniform(VDVector3i(0, -3, 0), true, 5);
+    space.setChunkUniform(VDVector3i(1, -3, 0), false);
+    VDGrid* pCompressed = space.getChunk(VDVector3i(-1, 0, -1));
+    CHECK(pCompressed != nullptr && pCompressed->compress());
+
+    CHECK(VDWriteWorldFile(path, space));
+    // Writing reads compressed chunks as they are stored
+    CHECK(pCompressed->isCompressed());
+
+    VDWorldFile file;
+    CHECK(file.open(path));
+    if (!file.isOpen())
+        return;
+    CHECK(file.gridSize() == space.gridSize);
+    CHECK(file.chunkCount() == space.chunkCount());
+    VDSpace loaded(file.gridSize(), file.anchor());
+    VDuint loadedCount = 0;
+    CHECK(file.loadAll(loaded, loadedCount) && loadedCount == space.chunkCount());
+    CHECK(countDifferences(space, loaded) == 0);
+    VDGrid* pSolid = loaded.getChunk(VDVector3i(0, -3, 0));
+    CHECK(pSolid != nullptr && pSolid->uniform == VD_CHUNK_SOLID && pSolid->uniformVoxel.material == 5);
+
+    // Anchors whole chunks apart shift the chunk coordinates, the voxels stay where they were
+    VDSpace shifted(20, VDVector3i(13, -40, -17));
+    CHECK(file.loadAll(shifted, loadedCount) && loadedCount == space.chunkCount());
+    CHECK(countDifferences(space, shifted) == 0);
+    pSolid = shifted.getChunk(VDVector3i(-1, -1, 1));
+    CHECK(pSolid != nullptr && pSolid->uniform == VD_CHUNK_SOLID && pSolid->uniformVoxel.material == 5);
+    VDSpace single(20, VDVector3i(13, -40, -17));
+    CHECK(file.loadChunk(single, single.getChunkCoord(VDVector3(1.5f, 0.5f, 1.5f))) != nullptr);
+    VDVoxelRef painted = single.getVoxel(VDVector3(1.5f, 0.5f, 1.5f));
+    CHECK(painted.isValid() && painted.readVoxel().material == 7);
+
+    // Anchors that are not whole chunks apart and other grid sizes are refused
+    VDSpace misaligned(20, VDVector3i(-6, 0, 3));
+    CHECK(!file.loadAll(misaligned, loadedCount) && loadedCount == 0);
+    CHECK(file.loadChunk(misaligned, VDVector3i(0, 0, 0)) == nullptr);
+    CHECK(misaligned.chunkCount() == 0);
+    VDSpace otherSize(16, VDVector3i(-7, 0, 3));
+    CHECK(!file.loadAll(otherSize, loadedCount));
+    CHECK(otherSize.chunkCount() == 0);
+    file.close();
+    std::remove(path);
+}
+
+static void testCompression()
+{
+    std::mt19937 rng(2);
+    // One word and several words per row, and a chunk size that is not a power of two
+    for (VDuint size : { 16u, 20u, 70u })
+    {
+        VDSpace space(size, VDVector3i(-3, 0, 5));
+        VDGrid* pChunk = space.setChunkOccupied(VDVector3i(1, -1, 0));
+        for (VDuint z = 0; z < size; z++)
+        {
+            for (VDuint y = 0; y < size; y++)
+            {
+                // Runs of empty and full rows next to noisy ones
+                VDuint kind = (y / 3 + z) % 4;
+                for (VDuint x = 0; x < size; x++)
+                {
+                    if (kind == 1 || (kind == 2 && rng() % 3 == 0))
+                        pChunk->setOccupied(x, y, z);
+                }
+            }
+        }
+        for (VDuint i = 0; i < pChunk->indexCount; i++)
+            pChunk->voxels[i].material = (uint8_t)(rng() % 5);
+        std::vector<uint64_t> occupancy(pChunk->occupancy, pChunk->occupancy + pChunk->wordCount());
+        std::vector<uint8_t> materials;
+        std::vector<bool> occupied;
+        for (VDuint i = 0; i < pChunk->indexCount; i++)
+        {
+            materials.push_back(pChunk->voxels[i].material);
+            occupied.push_back(pChunk->getOccupied(i));
+        }
+        std::vector<uint64_t> bricks(pChunk->brickOccupancy, pChunk->brickOccupancy + pChunk->brickWordCount());
+        VDuint occupiedBricks = pChunk->occupiedBricks;
+
+        CHECK(pChunk->compress());
+        CHECK(pChunk->isCompressed());
+        CHECK(pChunk->occupancy == nullptr && pChunk->voxels == nullptr);
+        CHECK(memcmp(pChunk->readBricks(), bricks.data(), bricks.size() * sizeof(uint64_t)) == 0);
+        // Compressed chunks answer queries without expanding
+        bool same = true;
+        for (VDuint i = 0; i < pChunk->indexCount; i++)
+            same = same && pChunk->getOccupied(i) == occupied[i] && pChunk->voxelRef(i).readVoxel().material == materials[i];
+        CHECK(same);
+        CHECK(pChunk->isCompressed());
+
+        pChunk->decompress();
+        CHECK(!pChunk->isCompressed());
+        CHECK(memcmp(pChunk->occupancy, occupancy.data(), occupancy.size() * sizeof(uint64_t)) == 0);
+        same = true;
+        for (VDuint i = 0; i < pChunk->indexCount; i++)
+            same = same && pChunk->voxels[i].material == materials[i];
+        CHECK(same);
+        CHECK(pChunk->occupiedBricks == occupiedBricks);
+        CHECK(memcmp(pChunk->brickOccupancy, bricks.data(), bricks.size() * sizeof(uint64_t)) == 0);
+    }
+
+    // Traces cross the empty bricks of compressed chunks like those of dense ones
+    VDSpace space(32, VDVector3i(0, 0, 0));
+    space.setVoxelOccupied(VDVector3(1.5f, 1.5f, 1.5f));
+    space.setVoxelOccupied(VDVector3(31.5f, 0.5f, 0.5f));
+    VDGrid* pChunk = space.getChunk(VDVector3i(0, 0, 0));
+    VDuint visits[2] = {};
+    float hits[2] = {};
+    for (int compressed = 0; compressed < 2; compressed++)
+    {
+        if (compressed == 1)
+            CHECK(pChunk->compress());
+        space.traceRay(VDVector3(-1.0f, 0.5f, 0.5f), VDVector3(1, 0, 0), 100.0f, false, [&](VDGrid* pVisited, VDuint index, VDVector3i, float distance, VDVector3)
+            {
+                visits[compressed]++;
+                if (!pVisited->getOccupied(index))
+                    return true;
+                hits[compressed] = distance;
+                return false;
+            });
+    }
+    CHECK(pChunk->isCompressed());
+    // Only the two bricks holding voxels are walked voxel by voxel
+    CHECK(visits[0] == 2 * VD_BRICK_SIZE && visits[1] == visits[0]);
+    CHECK(hits[0] == 32.0f && hits[1] == hits[0]);
+}
+
+static void testUniformChunks()
+{
+    VDSimulation simulation(16, VDVector3i(0, 0, 0));
+    VDSpace& space = simulation.space;
+    // New chunks start empty without voxel storage, edits that change nothing keep it that way
+    VDGrid* pChunk = space.setChunkOccupied(VDVector3i(0, 0, 0));
+    CHECK(pChunk->uniform == VD_CHUNK_EMPTY && pChunk->voxels == nullptr && pChunk->occupancy == nullptr);
+    space.getVoxel(VDVector3(3.5f, 3.5f, 3.5f)).setOccupied(false);
+    CHECK(pChunk->uniform == VD_CHUNK_EMPTY && pChunk->voxels == nullptr);
+    CHECK(!space.anyOccupied(VDAABB(VDVector3(0, 0, 0), VDVector3(16, 16, 16))));
+    // The first different voxel materializes the chunk, compressing it once it is uniform again drops the storage
+    space.getVoxel(VDVector3(3.5f, 3.5f, 3.5f)).setOccupied(true);
+    CHECK(pChunk->uniform == VD_CHUNK_MIXED && pChunk->voxels != nullptr);
+    CHECK(space.countOccupied(VDAABB(VDVector3(0, 0, 0), VDVector3(16, 16, 16))) == 1);
+    space.getVoxel(VDVector3(3.5f, 3.5f, 3.5f)).setOccupied(false);
+    CHECK(pChunk->compress());
+    CHECK(pChunk->uniform == VD_CHUNK_EMPTY && !pChunk->isCompressed() && pChunk->voxels == nullptr);
+
+    // Solid chunks answer occupancy and material from their state
+    VDGrid* pSolid = space.setChunkUniform(VDVector3i(0, -1, 0), true, 3);
+    CHECK(pSolid->uniform == VD_CHUNK_SOLID && pSolid->voxels == nullptr);
+    VDVoxelRef inside = space.getVoxel(VDVector3(8.5f, -8.5f, 8.5f));
+    CHECK(inside.isOccupied() && inside.readVoxel().material == 3);
+    CHECK(space.countOccupied(VDAABB(VDVector3(0, -16, 0), VDVector3(16, 0, 16))) == 16 * 16 * 16);
+    inside.setOccupied(true);
+    CHECK(pSolid->uniform == VD_CHUNK_SOLID);
+    // A body resting on it and rays hitting it read the state without materializing the chunk
+    VDHandle body = simulation.createAABBBody(VDAABB::fromMidPointAndHalfExtents(VDVector3::half(), VDVector3(8.0f, 2.0f, 8.0f)), 1.0f);
+    for (int i = 0; i < 120; i++)
+        simulation.simulate(1.0f / 60.0f);
+    CHECK(fabsf(simulation.getBody(body).position().y - 0.5f) < 0.05f);
+    VDRayHit hit;
+    CHECK(space.rayCast(VDVector3(4.5f, 10.0f, 4.5f), VDVector3(0, -1, 0), 100.0f, hit) && fabsf(hit.distance - 10.0f) < 0.001f);
+    CHECK(pSolid->uniform == VD_CHUNK_SOLID && pSolid->voxels == nullptr);
+    // Carving a voxel materializes it with the solid material everywhere else
+    inside.setOccupied(false);
+    CHECK(pSolid->uniform == VD_CHUNK_MIXED && !inside.isOccupied());
+    CHECK(space.getVoxel(VDVector3(9.5f, -8.5f, 8.5f)).readVoxel().material == 3);
+
+    // World files store uniform chunks without a payload and load them back uniform
+    const char* path = "VoxelDynamicsUniform.vdw";
+    VDSpace uniformSpace(16, VDVector3i(0, 0, 0));
+    uniformSpace.setChunkUniform(VDVector3i(0, -1, 0), true, 4);
+    uniformSpace.setChunkUniform(VDVector3i(1, -1, 0), true, 0);
+    uniformSpace.setChunkOccupied(VDVector3i(0, 0, 0));
+    CHECK(VDWriteWorldFile(path, uniformSpace));
+    VDWorldFile file;
+    CHECK(file.open(path));
+    if (!file.isOpen())
+        return;
+    CHECK(file.file.size == sizeof(VDWorldFileHeader) + 3 * sizeof(VDWorldChunkEntry));
+    VDSpace loaded(16, VDVector3i(0, 0, 0));
+    VDuint loadedCount = 0;
+    CHECK(file.loadAll(loaded, loadedCount) && loadedCount == 3);
+    VDGrid* pLoaded = loaded.getChunk(VDVector3i(0, -1, 0));
+    CHECK(pLoaded != nullptr && pLoaded->uniform == VD_CHUNK_SOLID && pLoaded->uniformVoxel.material == 4 && pLoaded->voxels == nullptr);
+    pLoaded = loaded.getChunk(VDVector3i(0, 0, 0));
+    CHECK(pLoaded != nullptr && pLoaded->uniform == VD_CHUNK_EMPTY);
+    file.close();
+    std::remove(path);
+}
+
+// Compares every dense chunk's brick summary with one rebuilt from its occupancy
+static bool bricksMatchOccupancy(VDSpace& space)
+{
+    bool match = true;
+    space.forEachChunk([&](VDVector3i, const VDGrid* pConstChunk)
+        {
+            VDGrid* pChunk = const_cast<VDGrid*>(pConstChunk);
+            if (pChunk->uniform != VD_CHUNK_MIXED || pChunk->isCompressed())
+                return;
+            std::vector<uint64_t> bricks(pChunk->brickOccupancy, pChunk->brickOccupancy + pChunk->brickWordCount());
+            VDuint occupiedBricks = pChunk->occupiedBricks;
+            pChunk->rebuildBricks();
+            match = match && occupiedBricks == pChunk->occupiedBricks
+                && memcmp(bricks.data(), pChunk->brickOccupancy, bricks.size() * sizeof(uint64_t)) == 0;
+        });
+    return match;
+}
+
+static void testBrickSummary()
+{
+    std::mt19937 rng(3);
+    // A chunk size that leaves partial bricks at the high end
+    VDSpace space(18, VDVector3i(-5, 0, 2));
+    for (int round = 0; round < 20; round++)
+    {
+        // Single voxel edits set and clear bricks one voxel at a time
+        for (int i = 0; i < 400; i++)
+        {
+            VDVector3 position((float)(rng() % 40) - 20.5f, (float)(rng() % 20) - 10.5f, (float)(rng() % 40) - 20.5f);
+            if (rng() % 2 == 0)
+                space.setVoxelOccupied(position);
+            else if (space.getGrid(position) != nullptr)
+                space.getVoxel(position).setOccupied(false);
+        }
+        CHECK(bricksMatchOccupancy(space));
+        // Bulk edits write whole words and rescan the bricks they touched
+        VDVector3 center((float)(rng() % 40) - 20.0f, (float)(rng() % 20) - 10.0f, (float)(rng() % 40) - 20.0f);
+        VDEditSphere(space, center, 1.0f + (float)(rng() % 60) * 0.1f, rng() % 2 == 0, 1);
+        CHECK(bricksMatchOccupancy(space));
+        VDVector3 corner((float)(rng() % 40) - 20.0f, (float)(rng() % 20) - 10.0f, (float)(rng() % 40) - 20.0f);
+        VDEditBox(space, VDAABB(corner, corner + VDVector3(7.0f, 3.0f, 5.0f)), rng() % 3 != 0, 2);
+        CHECK(bricksMatchOccupancy(space));
+    }
+
+    // Clearing everything leaves no occupied brick behind
+    VDEditBox(space, VDAABB(VDVector3(-40, -20, -40), VDVector3(40, 20, 40)), false);
+    bool cleared = true;
+    space.forEachChunk([&](VDVector3i, const VDGrid* pChunk) { cleared = cleared && pChunk->isEmpty() && (pChunk->isUniform() || pChunk->occupiedBricks == 0); });
+    CHECK(cleared);
+}
+
+// First occupied voxel along the ray, found by testing the box of every occupied voxel
+static bool bruteForceRayCast(const VDSpace& space, VDVector3i low, VDVector3i high, VDVector3 from, VDVector3 dir, float maxDistance, float& distance)
+{
+    distance = FLT_MAX;
+    for (int z = low.z; z < high.z; z++)
+    {
+        for (int y = low.y; y < high.y; y++)
+        {
+            for (int x = low.x; x < high.x; x++)
+            {
+                VDVector3 voxelLow((float)x, (float)y, (float)z);
+                VDGrid* pChunk = space.getGrid(voxelLow + VDVector3::half());
+                if (pChunk == nullptr || !pChunk->getOccupied(voxelLow + VDVector3::half()))
+                    continue;
+                float voxelDistance;
+                VDVector3 normal;
+                if (VDRayIntersectAABB(from, dir, VDAABB(voxelLow, voxelLow + VDVector3(1, 1, 1)), voxelDistance, normal) && voxelDistance <= maxDistance)
+                    distance = VDMin(distance, voxelDistance);
+            }
+        }
+    }
+    return distance != FLT_MAX;
+}
+
+static void testRayCast()
+{
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    VDSpace space(16, VDVector3i(-16, -16, -16));
+    for (int cz = 0; cz < 2; cz++)
+    {
+        for (int cy = 0; cy < 2; cy++)
+        {
+            for (int cx = 0; cx < 2; cx++)
+            {
+                if (cx == 1 && cy == 1 && cz == 0)
+                    continue;
+                if (cx == 0 && cy == 1 && cz == 1)
+                {
+                    space.setChunkUniform(VDVector3i(cx, cy, cz), true, 2);
+                    continue;
+                }
+                VDGrid* pChunk = space.setChunkOccupied(VDVector3i(cx, cy, cz));
+                for (int i = 0; i < 40; i++)
+                    pChunk->setOccupied(rng() % 16, rng() % 16, rng() % 16);
+                // Rays have to see the voxels of compressed chunks as they are stored
+                if (cx == 1 && cy == 0 && cz == 1)
+                    CHECK(pChunk->compress());
+            }
+        }
+    }
+    VDVector3i low(-16, -16, -16);
+    VDVector3i high(16, 16, 16);
+    VDuint hits = 0;
+    for (int i = 0; i < 500; i++)
+    {
+        VDVector3 from(unit(rng) * 24.0f, unit(rng) * 24.0f, unit(rng) * 24.0f);
+        VDVector3 dir = VDNormalize(VDVector3(unit(rng), unit(rng), unit(rng)));
+        VDRayHit hit;
+        float distance;
+        bool found = space.rayCast(from, dir, 60.0f, hit);
+        bool expected = bruteForceRayCast(space, low, high, from, dir, 60.0f, distance);
+        CHECK(found == expected);
+        if (!found || !expected)
+            continue;
+        hits++;
+        CHECK(fabsf(hit.distance - distance) < 1e-3f);
+        CHECK(hit.voxel.isValid() && hit.voxel.isOccupied());
+    }
+    CHECK(hits > 0);
+}
+
+// Material of an occupied voxel plus one, 0 for an empty one
+static int voxelState(VDSpace& space, int x, int y, int z)
+{
+    VDVoxelRef voxel = space.getVoxel(VDVector3(x + 0.5f, y + 0.5f, z + 0.5f));
+    return voxel.isValid() && voxel.isOccupied() ? voxel.readVoxel().material + 1 : 0;
+}
+
+// Runs edit and checks that pDirty holds, per chunk, exactly the bounds of the voxels it filled,
+// cleared or gave another material
+template <typename F>
+static void checkDirtyRegion(VDSpace& space, VDVector3i low, VDVector3i high, F edit)
+{
+    std::vector<int> before;
+    for (int z = low.z; z < high.z; z++)
+        for (int y = low.y; y < high.y; y++)
+            for (int x = low.x; x < high.x; x++)
+                before.push_back(voxelState(space, x, y, z));
+    VDDirtyRegion dirty;
+    VDuint changedChunks = edit(&dirty);
+
+    VDDirtyRegion expected;
+    size_t i = 0;
+    for (int z = low.z; z < high.z; z++)
+    {
+        for (int y = low.y; y < high.y; y++)
+        {
+            for (int x = low.x; x < high.x; x++)
+            {
+                if (before[i++] != voxelState(space, x, y, z))
+                {
+                    VDVector3 center(x + 0.5f, y + 0.5f, z + 0.5f);
+                    expected.add(space.getChunkCoord(center), VDVector3i(x, y, z), VDVector3i(x, y, z));
+                }
+            }
+        }
+    }
+    CHECK(changedChunks == expected.chunks.size());
+    CHECK(dirty.chunks.size() == expected.chunks.size());
+    for (const VDDirtyChunk& chunk : expected.chunks)
+    {
+        const VDuint* pEntry = dirty.chunkEntries.find(chunk.chunkCoord);
+        CHECK(pEntry != nullptr);
+        if (pEntry == nullptr)
+            continue;
+        const VDDirtyChunk& found = dirty.chunks[*pEntry];
+        CHECK(found.low.x == chunk.low.x && found.low.y == chunk.low.y && found.low.z == chunk.low.z);
+        CHECK(found.high.x == chunk.high.x && found.high.y == chunk.high.y && found.high.z == chunk.high.z);
+    }
+}
+
+static void testEditDirtyRegions()
+{
+    VDSpace space(16, VDVector3i(-5, -5, -5));
+    VDVector3i low(-24, -24, -24);
+    VDVector3i high(24, 24, 24);
+    // A box across chunk borders that covers none of them whole
+    checkDirtyRegion(space, low, high, [&](VDDirtyRegion* pDirty)
+        {
+            return VDEditBox(space, VDAABB(VDVector3(-7, -3, -9), VDVector3(6, 4, 2)), true, 3, pDirty);
+        });
+    // Carving into it only reports the voxels that were there
+    checkDirtyRegion(space, low, high, [&](VDDirtyRegion* pDirty)
+        {
+            return VDEditSphere(space, VDVector3(4.0f, 4.0f, 1.0f), 3.5f, false, 0, pDirty);
+        });
+    checkDirtyRegion(space, low, high, [&](VDDirtyRegion* pDirty)
+        {
+            return VDEditLine(space, VDVector3(-12.0f, 0.5f, -12.0f), VDVector3(12.0f, 2.5f, 10.0f), 1.5f, true, 1, pDirty);
+        });
+    // Refilling the box only reports the voxels the line gave another material
+    checkDirtyRegion(space, low, high, [&](VDDirtyRegion* pDirty)
+        {
+            return VDEditBox(space, VDAABB(VDVector3(-6, -2, -8), VDVector3(5, 3, 1)), true, 3, pDirty);
+        });
+}
+
+static void testJournalWrap()
+{
+    VDSpace space(16, VDVector3i(0, 0, 0));
+    VDChangeJournal& journal = *space.journal;
+    journal.capacity = 8;
+    uint64_t seen = 0;
+    std::vector<VDChunkChange> pulled;
+    auto pull = [&]()
+        {
+            pulled.clear();
+            return journal.pull(seen, [&](const VDChunkChange& change) { pulled.push_back(change); });
+        };
+
+    for (int i = 0; i < 5; i++)
+        space.setVoxelOccupied(VDVector3(i + 0.5f, 0.5f, 0.5f));
+    CHECK(pull());
+    CHECK(pulled.size() == 6);
+    // The ring drops its oldest changes but still holds everything after seen
+    for (int i = 0; i < 6; i++)
+        space.setVoxelOccupied(VDVector3(i + 0.5f, 1.5f, 0.5f));
+    CHECK(journal.changes.size() == 8);
+    CHECK(pull());
+    CHECK(pulled.size() == 6);
+    bool consecutive = true;
+    for (size_t i = 0; i < pulled.size(); i++)
+        consecutive = consecutive && pulled[i].version == journal.version - pulled.size() + 1 + i;
+    CHECK(consecutive);
+    CHECK(seen == journal.version);
+
+    // Falling behind by more than the capacity asks for a rescan
+    for (int i = 0; i < 20; i++)
+        space.setVoxelOccupied(VDVector3(i % 16 + 0.5f, 2.5f, (i / 16) + 0.5f));
+    CHECK(!pull());
+    CHECK(pulled.empty());
+    CHECK(seen == journal.version);
+    space.getVoxel(VDVector3(0.5f, 2.5f, 0.5f)).setOccupied(false);
+    CHECK(pull());
+    CHECK(pulled.size() == 1 && pulled[0].type == VD_CHANGE_VOXEL && pulled[0].wasOccupied && !pulled[0].occupied);
+
+    // Bulk edits journal the bounds of what they changed per chunk
+    VDEditBox(space, VDAABB(VDVector3(2, 5, 3), VDVector3(6, 7, 4)), true);
+    CHECK(pull());
+    CHECK(pulled.size() == 1 && pulled[0].type == VD_CHANGE_REGION);
+    CHECK(sameCoord(pulled[0].low, VDVector3i(2, 5, 3)) && sameCoord(pulled[0].high, VDVector3i(5, 6, 3)));
+}
+
+static void testEditWakeUp()
+{
+    for (int keepChanges = 1; keepChanges >= 0; keepChanges--)
+    {
+        VDSimulation simulation(16, VDVector3i(-8, -8, -8));
+        VDSpace& space = simulation.space;
+        if (keepChanges == 0)
+            space.journal->capacity = 0;
+        // One body resting on two voxels and another far enough away that edits to the first miss it
+        space.setVoxelOccupied(VDVector3(0.5f, 0.5f, 0.5f));
+        space.setVoxelOccupied(VDVector3(1.5f, 0.5f, 0.5f));
+        space.setVoxelOccupied(VDVector3(6.5f, 0.5f, 0.5f));
+        VDHandle supported = simulation.createAABBBody(VDAABB::fromMidPointAndHalfExtents(VDVector3(0.9f, 0.4f, 0.4f), VDVector3(1.0f, 2.0f, 0.5f)), 1.0f);
+        VDHandle other = simulation.createAABBBody(VDAABB::fromMidPointAndHalfExtents(VDVector3(0.4f, 0.4f, 0.4f), VDVector3(6.5f, 2.0f, 0.5f)), 1.0f);
+        for (int i = 0; i < 300; i++)
+            simulation.simulate(1.0f / 60.0f);
+        CHECK(simulation.getBody(supported).isSleeping() && simulation.getBody(other).isSleeping());
+        CHECK(fabsf(simulation.getBody(supported).position().y - 1.4f) < 0.05f);
+
+        // Removing one of the voxels wakes the body it held up and no other. Without kept
+        // changes the edit can not be located, so it wakes nobody rather than everybody.
+        space.getVoxel(VDVector3(1.5f, 0.5f, 0.5f)).setOccupied(false);
+        simulation.wakeEditedBodies();
+        CHECK(simulation.getBody(supported).isSleeping() == (keepChanges == 0));
+        CHECK(simulation.getBody(other).isSleeping());
+
+        // A body left with nothing below wakes by itself and falls
+        space.getVoxel(VDVector3(0.5f, 0.5f, 0.5f)).setOccupied(false);
+        for (int i = 0; i < 30; i++)
+            simulation.simulate(1.0f / 60.0f);
+        CHECK(simulation.getBody(supported).position().y < 1.0f);
+        CHECK(simulation.getBody(other).isSleeping());
+    }
+}
+
+// Chunks present in a are present in b with the same occupancy
+static bool sameChunks(const VDSpace& a, const VDSpace& b)
+{
+    bool same = a.chunkCount() == b.chunkCount();
+    a.forEachChunk([&](VDVector3i coord, const VDGrid* pChunk)
+        {
+            const VDGrid* pOther = b.getChunk(coord);
+            same = same && pOther != nullptr && pOther->uniform == pChunk->uniform;
+            for (VDuint i = 0; same && i < pChunk->indexCount; i++)
+                same = pChunk->getOccupied(i) == pOther->getOccupied(i);
+        });
+    return same;
+}
+
+static void testTerrainGeneration()
+{
+    // Several words per row and a surface that crosses the chunk
+    std::mt19937 rng(4);
+    VDGrid chunk(70, VDVector3(0, -10, 0), VD_INVALID_HANDLE_INDEX);
+    std::vector<float> heights(70 * 70);
+    for (size_t i = 0; i < heights.size(); i++)
+        heights[i] = (float)(rng() % 900) * 0.1f - 20.0f;
+    CHECK(VDFillHeightmap(chunk, heights.data()));
+    bool matches = true;
+    for (VDuint z = 0; z < 70; z++)
+    {
+        for (VDuint y = 0; y < 70; y++)
+        {
+            for (VDuint x = 0; x < 70; x++)
+                matches = matches && chunk.getOccupied(x, y, z) == (y - 10.0f + 0.5f < heights[x + z * 70]);
+        }
+    }
+    CHECK(matches);
+    chunk.release();
+    VDGrid high(16, VDVector3(0, 80, 0), VD_INVALID_HANDLE_INDEX);
+    CHECK(!VDFillHeightmap(high, heights.data()));
+    high.release();
+
+    TerrainSettings settings;
+    settings.seed = 5;
+    settings.baseHeight = 4.0f;
+    settings.amplitude = 10.0f;
+    settings.frequency = 0.05f;
+    settings.caveFrequency = 0.1f;
+    settings.caveThreshold = 0.3f;
+    VDWorkerPool pool(4);
+    VDVector3i lowChunk(-2, -2, -2);
+    VDVector3i highChunk(1, 1, 1);
+    for (int generator = 0; generator < 2; generator++)
+    {
+        VDChunkLoader loader = generator == 0 ? heightmapGenerator(settings) : densityGenerator(settings);
+        // Worker threads generate the same chunks as the calling thread alone
+        VDSpace serial(16, VDVector3i(0, 0, 0));
+        VDSpace parallel(16, VDVector3i(0, 0, 0));
+        VDuint added = VDGenerateChunks(serial, lowChunk, highChunk, loader);
+        CHECK(added > 0);
+        CHECK(VDGenerateChunks(parallel, lowChunk, highChunk, loader, &pool) == added);
+        CHECK(sameChunks(serial, parallel));
+        // Nothing lies above the highest possible surface, the ground far below it is kept
+        CHECK(!serial.validateChunkCoord(VDVector3i(0, 1, 0)));
+        CHECK(serial.validateChunkCoord(VDVector3i(0, -2, 0)));
+        // Chunks the space already holds are left alone
+        CHECK(VDGenerateChunks(parallel, lowChunk, highChunk, loader, &pool) == 0);
+    }
+
+    // Without caves every column is solid up to its surface
+    settings.caves = false;
+    VDSpace flat(16, VDVector3i(0, 0, 0));
+    VDGenerateChunks(flat, lowChunk, highChunk, heightmapGenerator(settings), &pool);
+    bool columns = true;
+    for (int x = -32; x < 32; x += 7)
+    {
+        for (int z = -32; z < 32; z += 5)
+        {
+            columns = columns && flat.getVoxel(VDVector3(x + 0.5f, -6.5f, z + 0.5f)).isOccupied();
+            VDVoxelRef air = flat.getVoxel(VDVector3(x + 0.5f, 14.5f, z + 0.5f));
+            columns = columns && (!air.isValid() || !air.isOccupied());
+        }
+    }
+    CHECK(columns);
+}
+
+static void testIndexRoundTrips()
+{
+    // Power of two sizes take the shift paths, the others divide
+    for (VDuint size : { 8u, 16u, 64u, 5u, 20u, 70u })
+    {
+        VDSpace space(size, VDVector3i(3, -5, 7));
+        CHECK((space.gridShift != VD_NO_GRID_SHIFT) == ((size & (size - 1)) == 0));
+        VDGrid* pChunk = space.setChunkOccupied(VDVector3i(0, 0, 0));
+        space.setChunkOccupied(VDVector3i(-1, 0, 0));
+        int s = (int)size;
+        bool indices = true;
+        bool moves = true;
+        for (VDuint index = 0; index < pChunk->indexCount; index++)
+        {
+            VDVector3i coords = pChunk->getCoordinates(index);
+            indices = indices && pChunk->validateCoords(coords) && pChunk->getIndex(coords.x, coords.y, coords.z) == index;
+            // Neighbours match stepping the cell and splitting it back into chunk and voxel coordinates
+            for (int direction = 0; direction < 6; direction++)
+            {
+                VDVector3i cell = coords + VDVector3i(VDDirectionToVector((VDDirection)direction));
+                VDVector3i expectedChunk = space.getCellChunkCoord(cell);
+                VDVector3i chunkCoord(0, 0, 0);
+                VDVector3i moved = space.moveIndex(index, chunkCoord, (VDDirection)direction);
+                moves = moves && sameCoord(chunkCoord, expectedChunk) && sameCoord(moved, cell - expectedChunk * s);
+            }
+        }
+        CHECK(indices);
+        CHECK(moves);
+        // Cells split into chunks by floor division either way
+        bool cells = true;
+        for (int c = -3 * s; c < 3 * s; c++)
+        {
+            VDVector3i chunkCoord = space.getCellChunkCoord(VDVector3i(c, -c, c / 2));
+            cells = cells && chunkCoord.x == (int)floorf((float)c / s) && chunkCoord.y == (int)floorf((float)-c / s)
+                && chunkCoord.z == (int)floorf((float)(c / 2) / s);
+        }
+        CHECK(cells);
+        // Moving from a chunk that does not exist reports it
+        VDVector3i missing(5, 5, 5);
+        CHECK(sameCoord(space.moveIndex(0, missing, VDDirection::LEFT), VDVector3i(-1, -1, -1)));
+    }
+}
+
+int main()
+{
+    testSlabPool();
+    testTypedPools();
+    testFrameArenas();
+    testAllocatorStats();
+    testHashMap();
+    testHandles();
+    testNegativeChunks();
+    testStreaming();
+    testWorldFile();
+    testCompression();
+    testUniformChunks();
+    testBrickSummary();
+    testRayCast();
+    testEditDirtyRegions();
+    testJournalWrap();
+    testEditWakeUp();
+    testTerrainGeneration();
+    testIndexRoundTrips();
+    if (failures > 0)
+    {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}